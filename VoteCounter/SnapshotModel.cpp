@@ -2,6 +2,12 @@
 #include "QMetaUtilities.hpp"
 #include "MouseLogic.hpp"
 #include "ScopedTimer.hpp"
+#include "LoggingHub.hpp"
+#include "Profiler.hpp"
+#include "ImageWriter.hpp"
+#include "SubmissionQueue.hpp"
+#include "ScanlineFill.hpp"
+#include "LabelOpening.hpp"
 
 #include "QOpenCV.hpp"
 using namespace QOpenCV;
@@ -9,39 +15,109 @@ using namespace QOpenCV;
 #include <qt-json/json.h>
 using namespace QtJson;
 
+using QArtm::RunLengthMask;
+
+namespace {
+
+// palette index to card color, for the whole 8 bit range
+QVector< uchar > colorOfIndex( int colors, int gradations )
+{
+    QVector< uchar > lut( 256, 0 );
+    for(int i = 0; i < colors * gradations; ++i)
+        lut[i] = i / gradations;
+    return lut;
+}
+
+// Label classified pixels with their card color, or none when they are too
+// far from it.
+template< typename Index, typename Dist >
+void labelColors( const Index * indexData, const Dist * distData, int n_pixels,
+                  int scaledThresh, const uchar * colorOf, uchar * labels )
+{
+    for(int i = 0; i < n_pixels; ++i)
+        labels[i] = (distData[i] < scaledThresh) ? colorOf[ indexData[i] ] : QArtm::LabelOpening::NONE;
+}
+
+// Whether a Lab color is outside all the boxes, six floats each: the low
+// corner then the high one.
+inline bool outsideBoxes( const float * boxes, int count, const float * color )
+{
+    for(int b = 0; b < count; ++b, boxes += 6)
+        if (color[0] >= boxes[0] && color[1] >= boxes[1] && color[2] >= boxes[2]
+                && color[0] <= boxes[3] && color[1] <= boxes[4] && color[2] <= boxes[5])
+            return false;
+    return true;
+}
+
+}
+
 QStringSet SnapshotModel::s_cacheableImages = QStringSet() << "input";
 QStringSet SnapshotModel::s_resizedImages = QStringSet() << "input";
 QStringList SnapshotModel::s_colorNames = QStringList() << "green" << "pink" << "yellow";
+int SnapshotModel::s_colorGradations = 5;
+QVector< uchar > SnapshotModel::s_colorOfIndex = colorOfIndex( 3, 5 );
 QStringList SnapshotModel::s_persistentMasks = QStringList()
 << "train.contours.green" << "train.contours.pink" << "train.contours.yellow";
+QStringList SnapshotModel::s_recomputableMatrices = QStringList() << "lab" << "lab8" << "colorDiff";
+QSet< SnapshotModel * > SnapshotModel::s_liveModels;
+quint64 SnapshotModel::s_maskGeneration = 0;
+
+void SnapshotModel::configureColors(const QStringList &names, int gradations)
+{
+    Q_ASSERT( !names.isEmpty() );
+    int maxGradations = 256 / names.size();
+    if (gradations > maxGradations) {
+        qWarning() << "Only" << maxGradations << "gradations fit" << names.size() << "colors";
+        gradations = maxGradations;
+    }
+    s_colorNames = names;
+    s_colorGradations = std::max( gradations, 1 );
+
+    s_persistentMasks.clear();
+    foreach(QString color, s_colorNames)
+        s_persistentMasks << "train.contours." + color;
+
+    s_colorOfIndex = colorOfIndex( names.size(), s_colorGradations );
+}
 
-SnapshotModel::SnapshotModel(const QString& path, QObject *parent) :
+SnapshotModel::SnapshotModel(const QString& path, QObject *parent, const QVariantMap& parameters) :
     QObject(parent),
     m_originalPath(path),
+    m_parameters(parameters),
+    m_coarseThreshold(-1),
+    m_rejectThreshold(-1),
     m_scene(new QGraphicsScene(this)),
     m_mouseLogic( new MouseLogic(m_scene) ),
     m_mode(INERT),
-    m_color("green"),
+    m_color(s_colorNames.first()),
     m_flann(0),
     m_showColorDiff(false),
+    m_countedThreshold(-1),
+    m_countedSizeFilter(-1),
+    m_palettePreviewDirty(true),
     m_countWatcher(this),
-    m_networkManager( new QNetworkAccessManager(this) )
+    m_countsStarted(0),
+    m_countsLanded(0),
+    m_memoryUsage(0)
 {
 
     m_pens["counted"] = QPen(QColor(100,100,255, 200), 2);
     m_pens["+selection"] = QPen(QColor(128,255,128,128), 0);
     m_pens["-selection"] = QPen(QColor(255,128,128,128), 0);
+    m_pens["audience"] = QPen(QColor(255,255,255,160), 0, Qt::DashLine);
     m_rectSelection = new QGraphicsRectItem(0,m_scene);
     m_rectSelection->setVisible(false);
     m_rectSelection->setZValue(100.0);
 
     m_mouseLogic->setObjectName("mouseLogic");
     m_countWatcher.setObjectName("countWatcher");
-    m_networkManager->setObjectName("http");
+
+    s_liveModels << this;
 
     QMetaUtilities::connectSlotsByName( parent, this );
 
     qDebug() << "Loading" << qPrintable(path);
+    QArtm::ScopedTimer timer("load", true);
 
     // check if cache is present, create otherwise
     QFileInfo fi(path);
@@ -57,12 +133,20 @@ SnapshotModel::SnapshotModel(const QString& path, QObject *parent) :
     m_scene->addPixmap( QPixmap::fromImage( getImage("input") ) );
 
     loadData();
+    loadAudience();
 
     // try to load flann
     QString palette_file = m_parentDir.filePath("palette.png");
     QString flann_file = m_parentDir.filePath("flann.dat");
-    if ( QFileInfo(palette_file).exists() && QFileInfo(flann_file).exists()) {
-        cv::Mat paletteRGB = cv::imread( palette_file.toStdString(), -1 );
+    QArtm::ScopedTimer classifierTimer("load.classifier");
+    cv::Mat paletteRGB;
+    if ( QFileInfo(palette_file).exists() && QFileInfo(flann_file).exists())
+        paletteRGB = cv::imread( palette_file.toStdString(), -1 );
+    if ( !paletteRGB.empty() && paletteRGB.rows != s_colorNames.size() * s_colorGradations ) {
+        qWarning() << "Palette was learned for other colors, learn again";
+        paletteRGB = cv::Mat();
+    }
+    if ( !paletteRGB.empty() ) {
         cv::Mat paletteLab;
         paletteRGB.convertTo(paletteLab, CV_32FC3, 1.0/255.0);
         cv::cvtColor( paletteLab, paletteLab, CV_RGB2Lab );
@@ -81,13 +165,135 @@ SnapshotModel::SnapshotModel(const QString& path, QObject *parent) :
 
 SnapshotModel::~SnapshotModel()
 {
-    qDebug() << "closing snapshot...";
+    QArtm::ScratchArena::Stats scratch = m_scratch.stats();
+    qDebug() << "closing snapshot... (scratch buffers:"
+             << scratch.reuses << "reuses," << scratch.allocations << "allocations,"
+             << scratch.bytesAllocated / 1024 << "KB allocated)";
+    s_liveModels.remove(this);
     saveData();
 }
 
+void SnapshotModel::attach(QObject *ui)
+{
+    if (parent() == ui)
+        return;
+
+    setParent(ui);
+    QMetaUtilities::connectSlotsByName( ui, this );
+
+    // bring the counts up to date with the UI values changed while away
+    if (m_mode == COUNT && hasCounted()) {
+        int threshold = uiValue("colorDiffThreshold").toInt(),
+            sizeFilter = uiValue("sizeFilter").toInt();
+        if (threshold != m_countedThreshold)
+            computeColorDiff();
+        if (threshold != m_countedThreshold || sizeFilter != m_countedSizeFilter)
+            countCards();
+        reclassifyIfUnsure();
+    }
+    updateViews();
+}
+
+void SnapshotModel::detach()
+{
+    QObject * ui = parent();
+    if (!ui)
+        return;
+
+    // let the background count land while we still see the UI
+    landCount();
+
+    foreach(QObject * o, ui->findChildren<QObject*>() << ui)
+        QObject::disconnect(o, 0, this, 0);
+    setParent(0);
+}
+
+QMap< QString, qint64 > SnapshotModel::memoryReport() const
+{
+    QMap< QString, qint64 > report;
+    foreach(QString tag, m_matrices.keys()) {
+        const cv::Mat& matrix = m_matrices[tag];
+        // matrices wrapping someone else's data (like input) aren't ours
+        if (matrix.refcount)
+            report["matrix/" + tag] = matrix.total() * matrix.elemSize();
+    }
+    foreach(QString tag, m_images.keys())
+        report["image/" + tag] = m_images[tag].byteCount();
+    foreach(QString name, m_masks.keys())
+        report["mask/" + name] = m_masks[name].byteSize();
+    foreach(QString name, m_trainStats.keys())
+        report["stats/" + name] = m_trainStats[name].byteSize();
+    report["mask/audience"] = m_audience.byteSize();
+    report["scratch"] = m_scratch.byteSize();
+    foreach(QGraphicsItem * item, m_scene->items()) {
+        QGraphicsPixmapItem * pixmapItem = qgraphicsitem_cast<QGraphicsPixmapItem*>(item);
+        if (!pixmapItem)
+            continue;
+        QString name = pixmapItem->parentItem()
+                ? pixmapItem->parentItem()->data(ITEM_FULLNAME).toString()
+                : QString("input");
+        const QPixmap& pixmap = pixmapItem->pixmap();
+        report["pixmap/" + name] += (qint64)pixmap.width() * pixmap.height() * pixmap.depth() / 8;
+    }
+    return report;
+}
+
+qint64 SnapshotModel::memoryUsage() const
+{
+    // a background count may be adding to the matrices
+    if (m_countWatcher.isRunning())
+        return m_memoryUsage;
+
+    qint64 total = 0;
+    foreach(qint64 bytes, memoryReport())
+        total += bytes;
+    m_memoryUsage = total;
+    return total;
+}
+
+qint64 SnapshotModel::processMemoryUsage()
+{
+    qint64 total = 0;
+    foreach(SnapshotModel * model, s_liveModels)
+        total += model->memoryUsage();
+    return total;
+}
+
+qint64 SnapshotModel::releaseRecomputable()
+{
+    // a background count may be reading these
+    if (m_countWatcher.isRunning())
+        return 0;
+
+    qint64 freed = 0;
+    foreach(QString tag, s_recomputableMatrices) {
+        if (!m_matrices.contains(tag))
+            continue;
+        const cv::Mat& matrix = m_matrices[tag];
+        freed += matrix.total() * matrix.elemSize();
+        m_matrices.remove(tag);
+    }
+    freed += m_scratch.byteSize();
+    m_scratch.clear();
+    return freed;
+}
+
 QVariant SnapshotModel::uiValue(const QString &name, const char * property)
 {
-    return parent()->findChild<QObject*>(name)->property(property);
+    // a parameter by the widget's name stands in for what the widget holds,
+    // any other property goes by name.property
+    QString key = QString("%1.%2").arg(name).arg(property);
+    if (m_parameters.contains(key))
+        return m_parameters[key];
+    QByteArray held( property );
+    if (m_parameters.contains(name) && (held == "value" || held == "checked" || held == "text"))
+        return m_parameters[name];
+    QObject * widget = parent() ? parent()->findChild<QObject*>(name) : 0;
+    if (!widget) {
+        qWarning() << "No value for" << name;
+        return QVariant();
+    }
+    return widget->property(property);
 }
 
 void SnapshotModel::pick(int x, int y)
@@ -103,17 +309,28 @@ void SnapshotModel::pick(int x, int y)
                 return;
             } else
                 // use the result of previous pixel classification
-                layerName = "count.contours." + s_colorNames[ getMatrix("indices").at<int>(y,x) / COLOR_GRADATIONS ];
+                layerName = "count.contours." + s_colorNames[ s_colorOfIndex[ nearestIndex(x, y) ] ];
             break;
         case TRAIN:
             layerName = "train.contours." + m_color;
             break;
         }
         floodPickContour(x, y, fuzz, layerName);
+        saveData();
         updateViews();
     }
 }
 
+int SnapshotModel::cardCount(const QString &color)
+{
+    return layer("count.contours." + color)->childItems().count();
+}
+
+void SnapshotModel::setParameter(const QString &name, const QVariant &value)
+{
+    m_parameters[name] = value;
+}
+
 void SnapshotModel::setTrainMode(const QString &tag)
 {
     setMode(TRAIN);
@@ -130,10 +347,13 @@ void SnapshotModel::updateViews()
     switch (m_mode) {
     case TRAIN:
         layer("train")->setVisible(true);
+        if (m_palettePreviewDirty)
+            showPalettePreview();
         foreach(QString color, s_colorNames) {
             QGraphicsItem * l = layer( "train.contours." + color);
             int count = l->childItems().count();
-            parent()->findChild<QLabel*>( color + "TrainCount" )->setText( QString("%1").arg( count ) );
+            if (parent())
+                parent()->findChild<QLabel*>( color + "TrainCount" )->setText( QString("%1").arg( count ) );
             l->setVisible( color == m_color );
         }
         break;
@@ -142,10 +362,13 @@ void SnapshotModel::updateViews()
         layer("count.colorDiff")->setVisible( m_showColorDiff );
         layer("count.contours")->setVisible( !m_showColorDiff );
 
+        // nobody to show the counts to
+        if (!parent())
+            break;
+
         bool countsChanged = false;
         foreach(QString color, s_colorNames) {
-            int count = layer("count.contours." + color)->childItems().count();
-            QString countText = QString("%1").arg( count );
+            QString countText = QString("%1").arg( cardCount(color) );
             QLabel * widget =  parent()->findChild<QLabel*>( color + "Count" );
             countsChanged = countsChanged || (widget->text() != countText);
             widget->setText( countText );
@@ -163,38 +386,220 @@ void SnapshotModel::updateViews()
     }
 }
 
+void SnapshotModel::loadAudience()
+{
+    m_audiencePolygon.clear();
+    QFile file( m_parentDir.filePath("audience.json") );
+    if (file.open(QFile::ReadOnly)) {
+        bool ok = false;
+        QVariantList points = parse( QString::fromUtf8(file.readAll()), ok ).toMap()["polygon"].toList();
+        if (!ok)
+            qWarning() << "Couldn't read the audience from" << file.fileName();
+        foreach(QVariant point, points) {
+            QVariantList xy = point.toList();
+            if (xy.size() == 2)
+                m_audiencePolygon << QPointF( xy[0].toDouble(), xy[1].toDouble() );
+        }
+        if (m_audiencePolygon.size() < 3)
+            m_audiencePolygon.clear();
+    }
+    rasterizeAudience();
+}
+
+void SnapshotModel::setAudience(const QPolygonF &polygon)
+{
+    // the background count reads the old one
+    landCount();
+
+    m_audiencePolygon = polygon.size() >= 3 ? polygon : QPolygonF();
+    QString path = m_parentDir.filePath("audience.json");
+    if (m_audiencePolygon.isEmpty()) {
+        QFile::remove(path);
+    } else {
+        QVariantList points;
+        foreach(QPointF p, m_audiencePolygon)
+            points << QVariant( QVariantList() << p.x() << p.y() );
+        QVariantMap audience;
+        audience["polygon"] = points;
+        QFile file(path);
+        if (file.open(QFile::WriteOnly | QFile::Truncate))
+            file.write( serialize(audience) );
+        else
+            qWarning() << "Couldn't save the audience to" << path;
+    }
+    rasterizeAudience();
+    emit audienceChanged();
+
+    // what was left out of the classification may be in now
+    m_matrices.remove("indices");
+    m_matrices.remove("dists");
+    if (m_mode == COUNT && m_flann)
+        on_count_clicked();
+    else
+        updateViews();
+}
+
+void SnapshotModel::rasterizeAudience()
+{
+    QSize size = getImage("input").size();
+    cv::Size frame( size.width(), size.height() );
+    clearLayer("count.audience");
+
+    if (m_audiencePolygon.isEmpty()) {
+        // all of it, a run a row
+        QVector< RunLengthMask::Span > spans;
+        spans.reserve( frame.height );
+        for(int y = 0; y < frame.height; ++y)
+            spans << RunLengthMask::Span( y, 0, frame.width );
+        m_audience = RunLengthMask::fromSpans( spans, frame );
+        return;
+    }
+
+    QPolygonF scaled;
+    foreach(QPointF p, m_audiencePolygon)
+        scaled << QPointF( p.x() * frame.width, p.y() * frame.height );
+
+    // paint the bounding box of the polygon only, like the contours
+    std::vector< std::vector< cv::Point > > contours;
+    contours.push_back( toCvInt(scaled) );
+    cv::Rect bounds = cv::boundingRect( contours[0] ) & cv::Rect( cv::Point(), frame );
+    m_audience = RunLengthMask( frame );
+    if (bounds.area() > 0) {
+        cv::Mat patch( bounds.size(), CV_8UC1, cv::Scalar(0) );
+        cv::fillPoly( patch, contours, cv::Scalar(255), 8, 0, -bounds.tl() );
+        m_audience = RunLengthMask::fromMat( patch, frame, bounds.tl() );
+    }
+
+    QPainterPath outline;
+    outline.addPolygon( scaled );
+    outline.closeSubpath();
+    QGraphicsPathItem * item = new QGraphicsPathItem( outline, layer("count.audience") );
+    item->setPen( m_pens["audience"] );
+}
+
 void SnapshotModel::saveData()
 {
+    QArtm::ScopedTimer timer("save");
+    // only write what has changed, the actual writing happens in the background
+    QArtm::ImageWriter * writer = QArtm::ImageWriter::instance();
     foreach(QString name, s_persistentMasks) {
+        MaskState& state = m_maskState[name];
+        if (!state.dirty)
+            continue;
         QString fname = m_cacheDir.filePath(name + ".png");
-        if (m_matrices.contains(name)) {
-            cv::imwrite( fname.toStdString(), getMatrix(name) );
-        } else if (QFile( fname ).exists()) {
-            QFile( fname ).remove();
+        if (m_masks.contains(name)) {
+            writer->write( fname, m_masks[name].toMat(), state.generation );
+        } else {
+            writer->remove( fname, state.generation );
         }
+        state.dirty = false;
     }
 }
 
 void SnapshotModel::loadData()
 {
+    QArtm::ScopedTimer timer("load.masks");
     cv::Mat input = getMatrix("input");
     int mrows = input.rows, mcols = input.cols;
 
     foreach(QString name, s_persistentMasks) {
         QString fname = m_cacheDir.filePath(name + ".png");
-        if ( QFile(fname).exists() ) {
-            cv::Mat mask = cv::imread( fname.toStdString(), 0);
+        cv::Mat mask;
+        // the file might still be waiting to be written or removed
+        if ( QArtm::ImageWriter::instance()->pending(fname, &mask) ) {
+            if (mask.empty())
+                continue;
+        } else if ( QFile(fname).exists() ) {
+            mask = cv::imread( fname.toStdString(), 0);
+        }
+
+        if ( !mask.empty() ) {
             if (mask.rows == mrows && mask.cols == mcols) {
-                setMatrix(name, mask);
+                m_masks[name] = RunLengthMask::fromMat(mask);
                 detectContours(name);
             } else {
                 qDebug() << "Incompatible mask" << fname << ", removing";
-                QFile(fname).remove();
+                touchMask(name);
             }
         }
     }
 }
 
+void SnapshotModel::touchMask(const QString &name)
+{
+    MaskState& state = m_maskState[name];
+    state.generation = ++s_maskGeneration;
+    state.dirty = true;
+}
+
+void SnapshotModel::addToMask(const QString &name, const RunLengthMask &region)
+{
+    RunLengthMask& mask = this->mask(name);
+    if (m_trainStats.contains(name)) {
+        // only the pixels which weren't in yet
+        m_trainStats[name].accumulate( getMatrix("lab8"), region.subtracted(mask), 1 );
+        m_palettePreviewDirty = true;
+    }
+    mask |= region;
+    touchMask(name);
+}
+
+void SnapshotModel::removeFromMask(const QString &name, const RunLengthMask &region)
+{
+    RunLengthMask& mask = this->mask(name);
+    if (m_trainStats.contains(name)) {
+        // only the pixels which were in
+        m_trainStats[name].accumulate( getMatrix("lab8"), region.intersected(mask), -1 );
+        m_palettePreviewDirty = true;
+    }
+    mask -= region;
+    touchMask(name);
+}
+
+QArtm::ColorHistogram& SnapshotModel::trainStatistics(const QString &color)
+{
+    QString name = "train.contours." + color;
+    if (!m_trainStats.contains(name)) {
+        // start from the mask, edits keep it up to date from now on
+        QArtm::ColorHistogram& stats = m_trainStats[name];
+        if (m_masks.contains(name))
+            stats.accumulate( getMatrix("lab8"), m_masks[name], 1 );
+    }
+    return m_trainStats[name];
+}
+
+cv::Mat SnapshotModel::paletteFromStatistics()
+{
+    cv::Mat paletteLab;
+    foreach(QString color, s_colorNames) {
+        QArtm::ColorHistogram& stats = trainStatistics(color);
+        if (stats.isEmpty())
+            continue;
+        // back from 8 bit Lab to the float Lab of the classifier
+        cv::Mat centers = stats.kmeans(s_colorGradations);
+        centers.col(0) *= 100.0 / 255.0;
+        centers.colRange(1,3) -= 128.0;
+        paletteLab.push_back(centers);
+    }
+    return paletteLab;
+}
+
+void SnapshotModel::showPalettePreview()
+{
+    m_palettePreviewDirty = false;
+    clearLayer("train.palettePreview");
+
+    cv::Mat paletteLab = paletteFromStatistics();
+    if (paletteLab.empty())
+        return;
+    cv::Mat paletteRGB = labToRGB(paletteLab);
+    QImage palette( paletteRGB.data, paletteRGB.rows, 1, QImage::Format_RGB888 );
+    QGraphicsPixmapItem * gpi = new QGraphicsPixmapItem( QPixmap::fromImage(palette), layer("train.palettePreview") );
+    // right under the learned palette
+    gpi->setPos(0, 15);
+    gpi->scale(15,15);
+}
+
 QGraphicsItem * SnapshotModel::layer(const QString &name)
 {
     if (!m_layers.contains(name)) {
@@ -224,28 +629,15 @@ void SnapshotModel::clearLayer(const QString& name)
 
 void SnapshotModel::floodPickContour(int x, int y, int fuzz, const QString& layerName)
 {
-    // flood fill inside roi
-    cv::Mat input = getMatrix("lab");
-    cv::Mat mask = getMatrix( layerName );
-
-    cv::Rect bounds;
-    cv::Mat pickMask( input.rows+2, input.cols+2, CV_8UC1, cv::Scalar(0) );
-    int res = cv::floodFill(input, pickMask,
-                            cv::Point(x,y),
-                            0, // unused
-                            &bounds,
-                            cv::Scalar( fuzz,fuzz,fuzz ),
-                            cv::Scalar( fuzz,fuzz,fuzz ),
-                            4 | cv::FLOODFILL_MASK_ONLY | cv::FLOODFILL_FIXED_RANGE );
-
-    if (res < 1) return;
+    QArtm::ScopedTimer timer("train.pick");
+    // fuzz is in Lab units, 8 bit Lab stretches L from 0..100 to 0..255
+    cv::Vec3i tolerance( cvRound( fuzz * 255.0 / 100.0 ), fuzz, fuzz );
+    RunLengthMask picked = QArtm::ScanlineFill::fill( getMatrix("lab8"), cv::Point(x,y), tolerance );
+    if (picked.isEmpty()) return;
 
     // merge masks
-    cv::Rect img_bounds = bounds - cv::Point(1,1);
-    if (img_bounds.x < 0) img_bounds.x = 0;
-    if (img_bounds.y < 0) img_bounds.y = 0;
-
-    cv::Mat(mask, img_bounds) |= cv::Mat(pickMask, bounds) * 255;
+    addToMask( layerName, picked );
+    cv::Rect img_bounds = picked.boundingRect();
 
     // if intersected some polygons - remove these polygons and grow ROI with their bounds
     QRect q_bounds = toQt(img_bounds);
@@ -271,59 +663,48 @@ void SnapshotModel::unpick(int x, int y)
     foreach_item(QGraphicsPolygonItem *, unpicked_poly, m_scene->items(QPointF(x,y))) {
         QString layerName = unpicked_poly->parentItem()->data(ITEM_FULLNAME).toString();
 
-        // (un)draw this contour onto the mask
-        cv::Mat mask = getMatrix(layerName);
-        cv::floodFill( mask, cv::Point(x,y), cv::Scalar(0), 0, cv::Scalar(), cv::Scalar(), 4 | cv::FLOODFILL_FIXED_RANGE);
+        // (un)draw this contour from the mask
+        removeFromMask( layerName, mask(layerName).component( cv::Point(x,y) ) );
 
         // delete the polygon itself
         delete unpicked_poly;
     }
 
+    saveData();
     updateViews();
 }
 
 void SnapshotModel::on_learn_clicked()
 {
-    QVector<cv::Mat> centers_list;
-    int centers_count = 0;
-    cv::Mat input = getMatrix("lab");
+    QArtm::ScopedTimer timer("learn", true);
+    int sampleCap = QSettings().value("trainingSampleCap", 20000).toInt();
+
+    // collect (a subsample of) the training pixels of each color, in
+    // palette order
+    QVector<ColorTraining> trainings;
+    foreach(QString color, s_colorNames) {
+        QString maskTag = "train.contours." + color;
+        ColorTraining training;
+        if (m_masks.contains(maskTag))
+            training.sample = collectTrainingPixels( m_masks[maskTag], sampleCap );
+        if (training.sample.rows == 0) {
+            qWarning() << "Teach me" << color << "first";
+            return;
+        }
+        trainings << training;
+    }
+
+    // cluster all colors at once
+    QtConcurrent::blockingMap( trainings, &SnapshotModel::clusterColor );
 
-    int color_index = 0;
-
-    foreach(QString matrixTag, m_matrices.keys()) {
-        if (!matrixTag.startsWith("train.contours.")) continue;
-
-        QVector<ColorType> sample_pixels;
-        cv::Mat mask = getMatrix(matrixTag);
-
-        for(int i = 0; i<input.rows; ++i)
-            for(int j = 0; j<input.cols; ++j)
-                if (mask.at<unsigned char>(i,j))
-                    // copy this pixel
-                    sample_pixels
-                            << input.ptr<ColorType>(i)[j*3]
-                            << input.ptr<ColorType>(i)[j*3+1]
-                            << input.ptr<ColorType>(i)[j*3+2];
-
-        if (sample_pixels.size()==0) continue;
-
-        cv::Mat sample(sample_pixels.size()/3, 3, CV_32FC1, sample_pixels.data());
-        // cv::flann::hierarchicalClustering returns float centers even for integer palette
-        cv::Mat centers(COLOR_GRADATIONS, 3, CV_32FC1);
-        cvflann::KMeansIndexParams params(
-                    COLOR_GRADATIONS, // branching
-                    10, // max iterations
-                    cvflann::FLANN_CENTERS_KMEANSPP,
-                    0);
-        int n_clusters = cv::flann::hierarchicalClustering< ColorDistance >( sample, centers, params );
-        centers_list << centers;
-        centers_count += n_clusters;
-        color_index++;
-    }
-
-    cv::Mat paletteLab = cv::Mat( centers_count, 3, CV_32FC1 );
-    for(int i=0; i<centers_list.size(); ++i)
-        centers_list[i].copyTo( paletteLab.rowRange( i*COLOR_GRADATIONS,(i+1)*COLOR_GRADATIONS ) );
+    cv::Mat paletteLab = cv::Mat( trainings.size() * s_colorGradations, 3, CV_32FC1 );
+    for(int i=0; i<trainings.size(); ++i) {
+        const ColorTraining& training = trainings[i];
+        for(int j=0; j<s_colorGradations; ++j)
+            // repeat the last center if there were less clusters than gradations
+            training.centers.row( std::min(j, training.clusters - 1) )
+                    .copyTo( paletteLab.row( i*s_colorGradations + j ) );
+    }
     m_matrices.remove("paletteRGB");
     setMatrix("paletteLab", paletteLab);
 
@@ -334,9 +715,60 @@ void SnapshotModel::on_learn_clicked()
     qDebug() << "built FLANN classifier";
 
     updateViews();
+    emit paletteChanged();
 
 }
 
+cv::Mat SnapshotModel::collectTrainingPixels(const RunLengthMask &mask, int cap)
+{
+    QArtm::ScopedTimer timer("learn.sample");
+    cv::Mat input = getMatrix("lab");
+    int area = mask.area();
+    int size = (cap > 0) ? std::min(area, cap) : area;
+    cv::Mat sample( size, 3, CV_32FC1 );
+    if (size == 0)
+        return sample;
+
+    // reservoir sampling: copy whole runs while the reservoir fills up,
+    // then replace random entries with decreasing probability. Seeded, so
+    // the same training gives the same palette.
+    ColorType * reservoir = sample.ptr<ColorType>(0);
+    const size_t pixelSize = 3 * sizeof(ColorType);
+    cv::RNG rng(size);
+    int seen = 0;
+    for(int i = 0; i<input.rows; ++i) {
+        const ColorType * row = input.ptr<ColorType>(i);
+        for(RunLengthMask::RunIterator run = mask.rowBegin(i); run != mask.rowEnd(i); ++run) {
+            int j = run->begin;
+            if (seen < size) {
+                int take = std::min( run->end - j, size - seen );
+                memcpy( reservoir + seen*3, row + j*3, take * pixelSize );
+                seen += take;
+                j += take;
+            }
+            for(; j<run->end; ++j, ++seen) {
+                int slot = rng.uniform(0, seen + 1);
+                if (slot < size)
+                    memcpy( reservoir + slot*3, row + j*3, pixelSize );
+            }
+        }
+    }
+    return sample;
+}
+
+void SnapshotModel::clusterColor(ColorTraining &training)
+{
+    QArtm::ScopedTimer timer("learn.cluster");
+    // cv::flann::hierarchicalClustering returns float centers even for integer palette
+    training.centers = cv::Mat(s_colorGradations, 3, CV_32FC1);
+    cvflann::KMeansIndexParams params(
+                s_colorGradations, // branching
+                10, // max iterations
+                cvflann::FLANN_CENTERS_KMEANSPP,
+                0);
+    training.clusters = cv::flann::hierarchicalClustering< ColorDistance >( training.sample, training.centers, params );
+}
+
 void SnapshotModel::on_count_clicked()
 {
     if (m_mode != COUNT)
@@ -347,34 +779,421 @@ void SnapshotModel::on_count_clicked()
     }
 
     emit willCount();
-    m_countWatcher.setFuture( QtConcurrent::run( this, &SnapshotModel::classifyPixels ) );
+    m_countTimer.start();
+    // the widgets are read, and the thresholds recorded, here rather than
+    // on the worker
+    m_coarseThreshold = coarseThreshold();
+    m_rejectThreshold = rejectThreshold();
+    void (SnapshotModel::*classify)(int, int) = &SnapshotModel::classifyPixels;
+    // what the HUD shows until the count lands
+    memoryUsage();
+    ++m_countsStarted;
+    m_countWatcher.setFuture( QtConcurrent::run( this, classify, m_coarseThreshold, m_rejectThreshold ) );
+}
+
+void SnapshotModel::landCount()
+{
+    if (!m_countWatcher.isRunning())
+        return;
+    m_countWatcher.waitForFinished();
+    on_countWatcher_finished();
 }
 
 void SnapshotModel::on_countWatcher_finished()
 {
+    // the watcher still reports a count landed by hand, and a newer one
+    // may be running by then
+    if (m_countWatcher.isRunning() || m_countsLanded == m_countsStarted)
+        return;
+    m_countsLanded = m_countsStarted;
+
     computeColorDiff();
     countCards();
     updateViews();
+    // from the click to the counts on screen
+    if (m_countTimer.isValid()) {
+        QArtm::Profiler::instance()->record( "count", m_countTimer.nsecsElapsed() );
+        m_countTimer.invalidate();
+    }
+    QArtm::Profiler::instance()->count( "snapshots.counted" );
     emit doneCounting();
 }
 
 
+void SnapshotModel::reuseClassification(SnapshotModel &previous)
+{
+    if (!previous.hasCounted())
+        return;
+    m_reuse.reset( new Reuse );
+    m_reuse->input = previous.getImage("input");
+    m_reuse->indices = previous.getMatrix("indices");
+    m_reuse->dists = previous.getMatrix("dists");
+    m_reuse->paletteRGB = previous.getMatrix("paletteRGB").clone();
+    m_reuse->audience = previous.audience();
+    m_reuse->coarseThreshold = previous.m_coarseThreshold;
+    m_reuse->rejectThreshold = previous.m_rejectThreshold;
+    // a pixel moving by less than half the threshold can't take a card
+    // color along, only a pixel already next to it
+    m_reuse->tolerance = std::max( uiValue("colorDiffThreshold").toInt() / 2, 1 );
+}
+
+QVector< bool > SnapshotModel::changedTiles(const cv::Mat &input, const cv::Mat &previous, int y, int rows, int tolerance)
+{
+    int tiles = (input.cols + TILE - 1) / TILE;
+    QVector< bool > changed( tiles );
+    cv::Mat diff = m_scratch.get( "tileDiff", rows, TILE, CV_8UC3 );
+    for(int t = 0; t < tiles; ++t) {
+        cv::Rect tile( t * TILE, y, std::min( TILE, input.cols - t * TILE ), rows );
+        cv::Mat tileDiff = diff.colRange( 0, tile.width );
+        cv::absdiff( input(tile), previous(tile), tileDiff );
+        // any pixel will do, a small card raised over a corner leaves only
+        // a few in each tile
+        double largest = 0;
+        cv::minMaxLoc( tileDiff.reshape(1), 0, &largest );
+        changed[t] = largest > tolerance;
+    }
+    return changed;
+}
+
+int SnapshotModel::coarseThreshold()
+{
+    return uiValue("coarseToFine", "checked").toBool() ? uiValue("colorDiffThreshold").toInt() : -1;
+}
+
+int SnapshotModel::rejectThreshold()
+{
+    QVariant threshold = uiValue("colorDiffThreshold");
+    return threshold.isValid() ? threshold.toInt() : -1;
+}
+
+bool SnapshotModel::classifiedFor(int threshold) const
+{
+    if (m_rejectThreshold >= 0 && threshold > m_rejectThreshold)
+        return false;
+    return m_coarseThreshold < 0
+            || (threshold * COARSE_MARGIN >= m_coarseThreshold && threshold <= m_coarseThreshold * COARSE_MARGIN);
+}
+
+int SnapshotModel::scaledThreshold(double threshold)
+{
+    return std::min( (int)(3.0 * threshold * threshold * DIST_SCALE), 65535 );
+}
+
+void SnapshotModel::reclassifyIfUnsure()
+{
+    if (m_mode != COUNT || !hasCounted() || classifiedFor( uiValue("colorDiffThreshold").toInt() ))
+        return;
+    landCount();
+    if (classifiedFor( uiValue("colorDiffThreshold").toInt() ))
+        return;
+    QARTM_DEBUG << "The threshold moved past what the classification is sure of";
+    on_count_clicked();
+}
+
+void SnapshotModel::classifyCoarse(const cv::Mat &input, cv::Mat &indices, cv::Mat &dists)
+{
+    QArtm::ScopedTimer timer("count.classify.coarse");
+    cv::Size cellsSize( (input.cols + COARSE_SCALE - 1) / COARSE_SCALE, (input.rows + COARSE_SCALE - 1) / COARSE_SCALE );
+    indices.create( cellsSize, CV_8UC1 );
+    indices = cv::Scalar(0);
+    dists.create( cellsSize, CV_16UC1 );
+    dists = cv::Scalar(65535);
+
+    // the cells over the audience
+    cv::Rect area = m_audience.boundingRect();
+    if (area.area() <= 0)
+        return;
+    cv::Point tl( area.x / COARSE_SCALE, area.y / COARSE_SCALE );
+    cv::Rect cells( tl, cv::Point( (area.br().x + COARSE_SCALE - 1) / COARSE_SCALE,
+                                   (area.br().y + COARSE_SCALE - 1) / COARSE_SCALE ) );
+    cv::Rect pixels = cv::Rect( cells.x * COARSE_SCALE, cells.y * COARSE_SCALE,
+                                cells.width * COARSE_SCALE, cells.height * COARSE_SCALE )
+            & cv::Rect( cv::Point(), input.size() );
+
+    cv::Mat small, found, foundDists;
+    cv::resize( input(pixels), small, cells.size(), 0, 0, cv::INTER_AREA );
+    cvflann::SearchParams params(cvflann::FLANN_CHECKS_UNLIMITED, 0);
+    m_flann->knnSearch( small.reshape( 1, cells.area() ), found, foundDists, 1, params );
+    cv::Mat indicesOut = indices(cells), distsOut = dists(cells);
+    found.reshape( 1, cells.height ).convertTo( indicesOut, CV_8U );
+    foundDists.reshape( 1, cells.height ).convertTo( distsOut, CV_16U, DIST_SCALE );
+}
+
+QVector< bool > SnapshotModel::refinedTiles(const cv::Mat &coarseIndices, const cv::Mat &coarseDists,
+                                            int y, int rows, int cols, int nearDist, int farDist)
+{
+    int tiles = (cols + TILE - 1) / TILE;
+    QVector< bool > refined( tiles );
+    const uchar * colorOf = s_colorOfIndex.constData();
+    int background = s_colorNames.size();
+    // a cell around the tile too, the edge of a blob may be just outside
+    int top = std::max( y / COARSE_SCALE - 1, 0 ),
+        bottom = std::min( (y + rows + COARSE_SCALE - 1) / COARSE_SCALE + 1, coarseIndices.rows );
+    for(int t = 0; t < tiles; ++t) {
+        int left = std::max( t * TILE / COARSE_SCALE - 1, 0 ),
+            right = std::min( ((t + 1) * TILE + COARSE_SCALE - 1) / COARSE_SCALE + 1, coarseIndices.cols );
+        int label = -1;
+        for(int cy = top; cy < bottom && !refined[t]; ++cy) {
+            const IndexType * indexRow = coarseIndices.ptr<IndexType>(cy);
+            const DistType * distRow = coarseDists.ptr<DistType>(cy);
+            for(int cx = left; cx < right; ++cx) {
+                int dist = distRow[cx];
+                int cellLabel = dist < nearDist ? colorOf[ indexRow[cx] ] : background;
+                if ((dist >= nearDist && dist <= farDist) || (label >= 0 && cellLabel != label)) {
+                    refined[t] = true;
+                    break;
+                }
+                label = cellLabel;
+            }
+        }
+    }
+    return refined;
+}
+
+QVector< float > SnapshotModel::rejectionBoxes(int threshold)
+{
+    QVector< float > boxes;
+    if (threshold < 0)
+        return boxes;
+    // the distance a pixel is counted at, and a bit, so rounding doesn't
+    // reject what the search would have kept
+    float reach = std::sqrt( 3.0f ) * threshold + 1;
+    cv::Mat palette = getMatrix("paletteLab");
+    const uchar * colorOf = s_colorOfIndex.constData();
+    for(int c = 0; c < s_colorNames.size(); ++c) {
+        float box[6] = { FLT_MAX, FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX, -FLT_MAX };
+        bool any = false;
+        for(int i = 0; i < palette.rows; ++i) {
+            if (colorOf[i] != c)
+                continue;
+            any = true;
+            const ColorType * center = palette.ptr<ColorType>(i);
+            for(int axis = 0; axis < 3; ++axis) {
+                box[axis] = std::min( box[axis], center[axis] - reach );
+                box[axis + 3] = std::max( box[axis + 3], center[axis] + reach );
+            }
+        }
+        if (any)
+            for(int j = 0; j < 6; ++j)
+                boxes << box[j];
+    }
+    return boxes;
+}
+
+int SnapshotModel::nearestIndex(int x, int y)
+{
+    cv::Mat indices = getMatrix("indices");
+    // rejected before the search, with no index of its own
+    if (getMatrix("dists").at<DistType>(y, x) < 65535 || !m_flann)
+        return indices.at<IndexType>(y, x);
+    cv::Mat lab = getMatrix("lab");
+    cv::Mat query( 1, 3, CV_32FC1, lab.ptr<ColorType>(y) + 3 * x ), found, foundDists;
+    m_flann->knnSearch( query, found, foundDists, 1, cvflann::SearchParams(cvflann::FLANN_CHECKS_UNLIMITED, 0) );
+    return found.at<int>(0);
+}
+
 void SnapshotModel::classifyPixels()
 {
-    QArtm::ScopedTimer timer("K-Nearest Neighbour Search");
+    m_coarseThreshold = coarseThreshold();
+    m_rejectThreshold = rejectThreshold();
+    classifyPixels( m_coarseThreshold, m_rejectThreshold );
+}
+
+void SnapshotModel::classifyPixels(int coarseThreshold, int rejectThreshold)
+{
+    QArtm::ScopedTimer timer("count.classify", true);
 
     cv::Mat input = getMatrix("lab");
+    Q_ASSERT( getMatrix("paletteLab").rows <= 256 );
+    Q_ASSERT( m_audience.size() == input.size() );
+
+    // outside the audience nothing is close enough to a card color
+    cv::Mat indices( input.rows, input.cols, CV_8UC1, cv::Scalar(0) );
+    cv::Mat dists( input.rows, input.cols, CV_16UC1, cv::Scalar(65535) );
+
+    // the earlier snapshot's results hold if it was classified the same way
+    QScopedPointer< Reuse > reuse( m_reuse.take() );
+    cv::Mat previousInput, currentInput;
+    if (reuse) {
+        cv::Mat palette = getMatrix("paletteRGB");
+        if (reuse->indices.size() == input.size()
+                && reuse->input.width() == input.cols && reuse->input.height() == input.rows
+                && reuse->paletteRGB.size() == palette.size()
+                && reuse->paletteRGB.type() == palette.type()
+                && cv::norm( reuse->paletteRGB, palette, cv::NORM_INF ) == 0
+                && reuse->audience == m_audiencePolygon
+                && (reuse->coarseThreshold < 0 || reuse->coarseThreshold == coarseThreshold)
+                && (reuse->rejectThreshold < 0 || (rejectThreshold >= 0 && reuse->rejectThreshold >= rejectThreshold))) {
+            previousInput = cv::Mat( input.rows, input.cols, CV_8UC3,
+                                     (void*)reuse->input.constBits(), reuse->input.bytesPerLine() );
+            QImage image = getImage("input");
+            currentInput = cv::Mat( input.rows, input.cols, CV_8UC3,
+                                    (void*)image.constBits(), image.bytesPerLine() );
+        } else {
+            QARTM_DEBUG << "The earlier snapshot was classified differently, not reusing it";
+        }
+    }
+    int reusedTiles = 0, classifiedTiles = 0;
+
+    // a search on a smaller frame settles the tiles which are plainly
+    // background or plainly inside a blob
+    cv::Mat coarseIndices, coarseDists;
+    int nearDist = 0, farDist = 0;
+    if (coarseThreshold > 0) {
+        classifyCoarse( input, coarseIndices, coarseDists );
+        nearDist = scaledThreshold( (double)coarseThreshold / COARSE_MARGIN );
+        farDist = scaledThreshold( (double)coarseThreshold * COARSE_MARGIN );
+    }
+    int refinedTileCount = 0, filledTileCount = 0;
+
+    // pixels farther from every color of a card than the threshold are no
+    // card; a larger threshold classifies again
+    QVector< float > boxes = rejectionBoxes( rejectThreshold );
+    QVector< int > positions;
+    int rejectedPixels = 0;
+
+    // search a band of rows at a time, so the full precision results
+    // never take a whole frame
+    const int band = TILE;
+    cv::Mat queries, bandIndices, bandDists;
+    QVector< RunLengthMask::Span > spans, fills;
+    enum { COPY, SEARCH, FILL };
+    QVector< char > action;
+    cvflann::SearchParams params(cvflann::FLANN_CHECKS_UNLIMITED, 0);
+    for(int y = 0; y < input.rows; y += band) {
+        QArtm::ScopedTimer bandTimer("count.classify.band");
+        int rows = std::min( band, input.rows - y );
+        int tiles = (input.cols + TILE - 1) / TILE;
+        action.fill( SEARCH, tiles );
+
+        // tiles like the earlier snapshot's are copied from its results
+        if (!previousInput.empty()) {
+            QArtm::ScopedTimer diffTimer("count.classify.diff");
+            QVector< bool > changed = changedTiles( currentInput, previousInput, y, rows, reuse->tolerance );
+            for(int t = 0; t < tiles; ++t) {
+                if (changed[t]) {
+                    ++classifiedTiles;
+                    continue;
+                }
+                ++reusedTiles;
+                action[t] = COPY;
+                cv::Rect tile( t * TILE, y, std::min( TILE, input.cols - t * TILE ), rows );
+                reuse->indices(tile).copyTo( indices(tile) );
+                reuse->dists(tile).copyTo( dists(tile) );
+            }
+        }
 
-    int n_pixels = input.rows * input.cols;
-    cv::Mat indices( input.rows, input.cols, CV_32SC1 );
-    cv::Mat dists( input.rows, input.cols, CV_32FC1 );
+        // and the coarse results fill the tiles they are sure about
+        if (!coarseIndices.empty()) {
+            QVector< bool > refined = refinedTiles( coarseIndices, coarseDists, y, rows, input.cols, nearDist, farDist );
+            for(int t = 0; t < tiles; ++t) {
+                if (action[t] == COPY)
+                    continue;
+                if (refined[t]) {
+                    ++refinedTileCount;
+                } else {
+                    ++filledTileCount;
+                    action[t] = FILL;
+                }
+            }
+        }
 
-    cv::Mat input_1 = input.reshape( 1, n_pixels ),
-            indices_1 = indices.reshape( 1, n_pixels ),
-            dists_1 = dists.reshape( 1, n_pixels );
+        // the audience pixels of the band in the tiles left to classify
+        spans.clear();
+        fills.clear();
+        int n_pixels = 0;
+        for(int row = y; row < y + rows; ++row)
+            for(RunLengthMask::RunIterator run = m_audience.rowBegin(row); run != m_audience.rowEnd(row); ++run) {
+                for(int t = run->begin / TILE; t * TILE < run->end; ++t) {
+                    if (action[t] == COPY)
+                        continue;
+                    QVector< RunLengthMask::Span >& out = action[t] == SEARCH ? spans : fills;
+                    int begin = std::max( run->begin, t * TILE ),
+                        end = std::min( run->end, (t + 1) * TILE );
+                    // next to the previous span, make it one
+                    if (!out.isEmpty() && out.last().row == row && out.last().end == begin)
+                        out.last().end = end;
+                    else
+                        out << RunLengthMask::Span( row, begin, end );
+                    if (action[t] == SEARCH)
+                        n_pixels += end - begin;
+                }
+            }
 
-    cvflann::SearchParams params(cvflann::FLANN_CHECKS_UNLIMITED, 0);
-    m_flann->knnSearch( input_1, indices_1, dists_1, 1, params);
+        foreach(const RunLengthMask::Span& span, fills) {
+            const IndexType * coarseIndex = coarseIndices.ptr<IndexType>( span.row / COARSE_SCALE );
+            const DistType * coarseDist = coarseDists.ptr<DistType>( span.row / COARSE_SCALE );
+            IndexType * indexRow = indices.ptr<IndexType>(span.row);
+            DistType * distRow = dists.ptr<DistType>(span.row);
+            for(int x = span.begin; x < span.end; ++x) {
+                indexRow[x] = coarseIndex[ x / COARSE_SCALE ];
+                distRow[x] = coarseDist[ x / COARSE_SCALE ];
+            }
+        }
+        if (!n_pixels)
+            continue;
+
+        cv::Mat indicesOut = indices.rowRange( y, y+rows ),
+                distsOut = dists.rowRange( y, y+rows );
+
+        if (boxes.isEmpty() && n_pixels == rows * input.cols) {
+            // all of the band, straight from the frame
+            bandIndices.create( n_pixels, 1, CV_32SC1 );
+            bandDists.create( n_pixels, 1, CV_32FC1 );
+            m_flann->knnSearch( input.rowRange( y, y+rows ).reshape( 1, n_pixels ),
+                                bandIndices, bandDists, 1, params);
+            bandIndices.reshape( 1, rows ).convertTo( indicesOut, CV_8U );
+            bandDists.reshape( 1, rows ).convertTo( distsOut, CV_16U, DIST_SCALE );
+            continue;
+        }
+
+        // gather the pixels which may be near a card color, search, scatter
+        // back; the others keep the saturated distance
+        queries.create( n_pixels, 3, CV_32FC1 );
+        positions.resize( n_pixels );
+        int k = 0;
+        foreach(const RunLengthMask::Span& span, spans) {
+            const ColorType * pixel = input.ptr<ColorType>(span.row) + 3 * span.begin;
+            int position = span.row * input.cols + span.begin;
+            for(int x = span.begin; x < span.end; ++x, pixel += 3, ++position) {
+                if (!boxes.isEmpty() && outsideBoxes( boxes.constData(), boxes.size() / 6, pixel ))
+                    continue;
+                ColorType * query = queries.ptr<ColorType>(k);
+                query[0] = pixel[0];
+                query[1] = pixel[1];
+                query[2] = pixel[2];
+                positions[k++] = position;
+            }
+        }
+        rejectedPixels += n_pixels - k;
+        if (!k)
+            continue;
+        bandIndices.create( k, 1, CV_32SC1 );
+        bandDists.create( k, 1, CV_32FC1 );
+        m_flann->knnSearch( queries.rowRange( 0, k ), bandIndices, bandDists, 1, params);
+
+        const int * foundIndex = bandIndices.ptr<int>(0);
+        const float * foundDist = bandDists.ptr<float>(0);
+        IndexType * indexData = indices.ptr<IndexType>(0);
+        DistType * distData = dists.ptr<DistType>(0);
+        for(int i = 0; i < k; ++i) {
+            indexData[ positions[i] ] = cv::saturate_cast<IndexType>( foundIndex[i] );
+            distData[ positions[i] ] = cv::saturate_cast<DistType>( foundDist[i] * DIST_SCALE );
+        }
+    }
+
+    if (reusedTiles + classifiedTiles) {
+        QArtm::Profiler::instance()->count( "tiles.reused", reusedTiles );
+        QArtm::Profiler::instance()->count( "tiles.classified", classifiedTiles );
+        QARTM_DEBUG << "Reused" << reusedTiles << "tiles of" << reusedTiles + classifiedTiles;
+    }
+    if (refinedTileCount + filledTileCount) {
+        QArtm::Profiler::instance()->count( "tiles.refined", refinedTileCount );
+        QArtm::Profiler::instance()->count( "tiles.filled", filledTileCount );
+        QARTM_DEBUG << "Refined" << refinedTileCount << "tiles of" << refinedTileCount + filledTileCount;
+    }
+    if (!boxes.isEmpty())
+        QArtm::Profiler::instance()->count( "pixels.rejected", rejectedPixels );
 
     setMatrix("indices", indices);
     setMatrix("dists", dists);
@@ -382,48 +1201,75 @@ void SnapshotModel::classifyPixels()
 
 void SnapshotModel::computeColorDiff()
 {
-    float thresh = parent()->findChild<QAbstractSlider*>("colorDiffThreshold")->value();
-    thresh = 3.0 * thresh * thresh;
-
-    cv::Mat thresholdedDiff;
-    cv::threshold(getMatrix("dists"), thresholdedDiff, thresh, 0, cv::THRESH_TRUNC);
-    thresholdedDiff.convertTo( thresholdedDiff, CV_8UC1, - 255.0 / thresh, 255.0 );
+    QArtm::ScopedTimer timer("count.threshold");
+    m_countedThreshold = uiValue("colorDiffThreshold").toInt();
+    int scaledThresh = scaledThreshold( m_countedThreshold );
 
     // poor man's LookUpTable
     cv::Mat indices = getMatrix("indices");
+    cv::Mat dists = getMatrix("dists");
+    const IndexType * indexData = indices.ptr<IndexType>(0);
+    const DistType * distData = dists.ptr<DistType>(0);
     int n_pixels = indices.rows * indices.cols;
     cv::Mat lut = getMatrix("paletteRGB");
-    // actual per-card-color masks
-    QVector<cv::Mat> cardMasks;
-    for(int i=0; i<3; i++)
-        cardMasks << cv::Mat(  indices.rows, indices.cols, CV_8UC1, cv::Scalar(0) );
-
-    for(int i=0; i<n_pixels; i++) {
-        if (thresholdedDiff.data[i]) {
-            int index = indices.ptr<int>(0)[i];
-            int color = index / COLOR_GRADATIONS;
-            cardMasks[color].data[i] = 1;
-        }
+    const uchar * colorOf = s_colorOfIndex.constData();
+    // the card color of every pixel, none outside the audience
+    cv::Size frame = indices.size();
+    bool partial = m_audience.area() < n_pixels;
+    cv::Mat labels = m_scratch.get( "labels", frame, CV_8UC1 );
+    if (partial)
+        labels = cv::Scalar( QArtm::LabelOpening::NONE );
+
+    {
+        QArtm::ScopedTimer splitTimer("count.threshold.split");
+        for(int row = 0; row < frame.height; ++row)
+            for(RunLengthMask::RunIterator run = m_audience.rowBegin(row); run != m_audience.rowEnd(row); ++run) {
+                int offset = row * frame.width + run->begin;
+                labelColors( indexData + offset, distData + offset, run->end - run->begin,
+                             scaledThresh, colorOf, labels.data + offset );
+            }
     }
 
-    for(int i=0; i<3; i++) {
-        cv::morphologyEx( cardMasks[i], cardMasks[i], cv::MORPH_OPEN, cv::Mat() );
-        setMatrix( "count.contours." + s_colorNames[i], cardMasks[i] );
+    // reusing the buffer of the previous one
+    cv::Mat& opened = m_matrices["labels"];
+    {
+        QArtm::ScopedTimer openTimer("count.threshold.open");
+        opened.create( frame, CV_8UC1 );
+        // the audience and a pixel around it, which is clear, so the opening
+        // comes out the same as on the whole frame
+        cv::Rect area = m_audience.boundingRect();
+        if (area.area() > 0)
+            area = cv::Rect( area.x - 1, area.y - 1, area.width + 2, area.height + 2 ) & cv::Rect( cv::Point(), frame );
+        if (partial)
+            opened = cv::Scalar( QArtm::LabelOpening::NONE );
+        if (area.area() > 0) {
+            cv::Mat openedArea = opened(area);
+            QArtm::LabelOpening::open( labels(area), openedArea, uiValue("openingSize").toInt() );
+        }
     }
 
-    // the display
-    cv::Mat colorDiff = cv::Mat( indices.rows, indices.cols, CV_8UC3, cv::Scalar(0,0,0,0) );
-    for(int i=0; i<n_pixels; i++) {
-        int index = indices.ptr<int>(0)[i];
-        int color = index / COLOR_GRADATIONS;
-        if (cardMasks[color].data[i]) {
-            colorDiff.data[i*3] = lut.data[ index*3 ];
-            colorDiff.data[i*3+1] = lut.data[ index*3 + 1 ];
-            colorDiff.data[i*3+2] = lut.data[ index*3 + 2 ];
-        }
+    // the masks of the colors are made when something needs them
+    foreach(QString color, s_colorNames) {
+        QString name = "count.contours." + color;
+        m_masks.remove( name );
+        m_labelMasks.insert( name );
     }
 
-    setMatrix("colorDiff", colorDiff);
+    // the display, reusing the buffer of the previous one
+    cv::Mat& colorDiff = m_matrices["colorDiff"];
+    colorDiff.create( indices.rows, indices.cols, CV_8UC3 );
+    colorDiff = cv::Scalar::all(0);
+    const uchar * labelData = opened.data;
+    for(int row = 0; row < frame.height; ++row)
+        for(RunLengthMask::RunIterator run = m_audience.rowBegin(row); run != m_audience.rowEnd(row); ++run)
+            for(int i = row * frame.width + run->begin; i < row * frame.width + run->end; i++) {
+                if (labelData[i] != QArtm::LabelOpening::NONE) {
+                    int index = indexData[i];
+                    colorDiff.data[i*3] = lut.data[ index*3 ];
+                    colorDiff.data[i*3+1] = lut.data[ index*3 + 1 ];
+                    colorDiff.data[i*3+2] = lut.data[ index*3 + 2 ];
+                }
+            }
 
     // display results
     clearLayer("count.colorDiff");
@@ -433,16 +1279,30 @@ void SnapshotModel::computeColorDiff()
 
 void SnapshotModel::countCards()
 {
-    int minSize = uiValue("sizeFilter").toInt();
-    minSize *= minSize;
-
-    for(int i = 0; i<3; i++) {
+    QArtm::ScopedTimer timer("count.contours");
+    m_countedSizeFilter = uiValue("sizeFilter").toInt();
+    m_countedAt = QDateTime::currentDateTime();
+    int minSize = m_countedSizeFilter * m_countedSizeFilter;
+    // there are no card pixels outside the audience, keep a pixel around
+    // it since find contours leaves the border out
+    cv::Rect area = m_audience.boundingRect();
+    if (area.area() > 0)
+        area = cv::Rect( area.x - 1, area.y - 1, area.width + 2, area.height + 2 )
+                & cv::Rect( cv::Point(), m_audience.size() );
+
+    for(int i = 0; i<s_colorNames.size(); i++) {
         QString layerName =  "count.contours." + s_colorNames[i];
 
-        // clone mask because find contours corrupts
-        cv::Mat mask = getMatrix(layerName).clone();
+        // rasterize into a scratch buffer, find contours corrupts it
         std::vector< std::vector< cv::Point > > contours;
-        cv::findContours(mask, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_TC89_L1);
+        if (area.area() > 0) {
+            cv::Mat mask = m_scratch.get( "contours", area.size(), CV_8UC1 );
+            if (m_labelMasks.contains(layerName))
+                cv::compare( getMatrix("labels")(area), i, mask, cv::CMP_EQ );
+            else
+                this->mask(layerName).toMat( mask, area );
+            cv::findContours(mask, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_TC89_L1, area.tl());
+        }
         // now refresh contour visuals
         clearLayer(layerName);
         int count = 0;
@@ -489,8 +1349,13 @@ QImage SnapshotModel::getImage(const QString &tag)
         }
         if (img.isNull()) {
             if (tag == "input") {
-                QArtm::ScopedTimer("Scaling the input image down");
-                img = QImage( m_originalPath )
+                QImage original;
+                {
+                    QArtm::ScopedTimer timer("load.decode", true);
+                    original = QImage( m_originalPath );
+                }
+                QArtm::ScopedTimer timer("load.scale", true);
+                img = original
                         .scaled( size_limit, size_limit, Qt::KeepAspectRatio, Qt::SmoothTransformation )
                         .convertToFormat(QImage::Format_RGB888);
             }
@@ -507,22 +1372,17 @@ cv::Mat SnapshotModel::getMatrix(const QString &tag)
     if (!m_matrices.contains(tag)) {
         cv::Mat matrix;
         // create some well known matrices
-        QSize qsz = getImage("input").size();
-        cv::Size inputSize = cv::Size( qsz.width(), qsz.height() );
-
         if (tag == "lab") {
+            QArtm::ScopedTimer timer("load.lab");
             cv::Mat input = getMatrix("input");
             input.convertTo(matrix, CV_32FC3, 1.0/255.0);
             cv::cvtColor( matrix, matrix, CV_RGB2Lab );
-        } else if (tag.contains(".contours.")) {
-            matrix = cv::Mat(inputSize.height, inputSize.width, CV_8UC1, cv::Scalar(0));
+        } else if (tag == "lab8") {
+            // compact Lab for interactive picking
+            QArtm::ScopedTimer timer("load.lab8");
+            cv::cvtColor( getMatrix("input"), matrix, CV_RGB2Lab );
         } else if (tag == "paletteRGB") {
-            cv::Mat paletteLab = getMatrix("paletteLab");
-            matrix = cv::Mat( paletteLab.rows, 3, CV_32FC1 );
-            cv::cvtColor( cv::Mat(paletteLab.rows, 1, CV_32FC3, paletteLab.data),
-                          cv::Mat(paletteLab.rows, 1, CV_32FC3, matrix.data),
-                          CV_Lab2RGB );
-            matrix.convertTo( matrix, CV_8UC1, 255.0 );
+            matrix = labToRGB( getMatrix("paletteLab") );
         } else if (tag == "input") {
             QImage img = getImage(tag);
             matrix = cv::Mat( img.height(), img.width(), CV_8UC3, (void*)img.constBits() );
@@ -541,6 +1401,30 @@ void SnapshotModel::setMatrix(const QString &tag, const cv::Mat &matrix)
     m_matrices[tag] = matrix;
 }
 
+RunLengthMask& SnapshotModel::mask(const QString &name)
+{
+    if (!m_masks.contains(name)) {
+        QSize qsz = getImage("input").size();
+        if (m_labelMasks.remove(name))
+            m_masks[name] = labelMask( s_colorNames.indexOf( name.mid( QString("count.contours.").size() ) ) );
+        else
+            m_masks[name] = RunLengthMask( qsz.height(), qsz.width() );
+    }
+    return m_masks[name];
+}
+
+RunLengthMask SnapshotModel::labelMask(int label)
+{
+    cv::Mat labels = getMatrix("labels");
+    // there are no labels outside the audience
+    cv::Rect area = m_audience.boundingRect();
+    if (area.area() <= 0)
+        return RunLengthMask( labels.size() );
+    cv::Mat mask = m_scratch.get( "labelMask", area.size(), CV_8UC1 );
+    cv::compare( labels(area), label, mask, cv::CMP_EQ );
+    return RunLengthMask::fromMat( mask, labels.size(), area.tl() );
+}
+
 void SnapshotModel::setImage(const QString &tag, const QImage &img)
 {
     m_images[tag] = img;
@@ -551,7 +1435,11 @@ void SnapshotModel::on_resetLayer_clicked()
     if (m_mode == TRAIN) {
         QString name = "train.contours." + m_color;
         clearLayer( name );
-        m_matrices.remove( name );
+        m_masks.remove( name );
+        m_trainStats.remove( name );
+        m_palettePreviewDirty = true;
+        touchMask( name );
+        saveData();
     }
     updateViews();
 }
@@ -562,6 +1450,16 @@ void SnapshotModel::setMode(SnapshotModel::Mode m)
     updateViews();
 }
 
+cv::Mat SnapshotModel::labToRGB(const cv::Mat &paletteLab)
+{
+    cv::Mat paletteRGB( paletteLab.rows, 3, CV_32FC1 );
+    cv::cvtColor( cv::Mat(paletteLab.rows, 1, CV_32FC3, paletteLab.data),
+                  cv::Mat(paletteLab.rows, 1, CV_32FC3, paletteRGB.data),
+                  CV_Lab2RGB );
+    paletteRGB.convertTo( paletteRGB, CV_8UC1, 255.0 );
+    return paletteRGB;
+}
+
 void SnapshotModel::showPalette()
 {
     cv::Mat paletteRGB = getMatrix("paletteRGB");
@@ -573,6 +1471,7 @@ void SnapshotModel::showPalette()
 
 void SnapshotModel::buildFlannRecognizer()
 {
+    QArtm::ScopedTimer timer("learn.index");
     cvflann::AutotunedIndexParams params( 0.8, 1, 0, 1.0 );
     //cvflann::LinearIndexParams params;
     if (m_flann) delete m_flann;
@@ -606,6 +1505,9 @@ void SnapshotModel::on_colorDiffOn_released()
 void SnapshotModel::on_colorDiffThreshold_valueChanged()
 {
     computeColorDiff();
+    // the slider being dragged waits for the release
+    if (!m_showColorDiff)
+        reclassifyIfUnsure();
 }
 
 void SnapshotModel::on_colorDiffThreshold_sliderPressed()
@@ -620,6 +1522,7 @@ void SnapshotModel::on_colorDiffThreshold_sliderReleased()
     m_showColorDiff = false;
     countCards();
     updateViews();
+    reclassifyIfUnsure();
 }
 
 void SnapshotModel::on_sizeFilter_valueChanged()
@@ -655,6 +1558,7 @@ void SnapshotModel::on_mouseLogic_rectSelected(QRectF rect, Qt::MouseButton butt
 
 void SnapshotModel::mergeContours(QRectF rect)
 {
+    QArtm::ScopedTimer timer("contours.merge");
     QMap<QString, QList<QGraphicsPolygonItem*> > collection;
 
     foreach_item(QGraphicsPolygonItem*, pi, m_scene->items(rect, Qt::ContainsItemShape)) {
@@ -664,19 +1568,22 @@ void SnapshotModel::mergeContours(QRectF rect)
 
     foreach(QString layerName, collection.keys()) {
         if (collection[layerName].size() < 2) continue;
-        QPolygonF superpoly;
+        // the hull of the union is the hull of all the corners, no need
+        // to unite the polygons first
+        std::vector<cv::Point2f> points, hull;
         foreach(QGraphicsPolygonItem* pi, collection[layerName]) {
-            superpoly = superpoly.united( pi->polygon() );
+            foreach(QPointF p, pi->polygon())
+                points.push_back( toCv(p) );
             delete pi;
         }
 
-        std::vector<cv::Point2f> contour = toCv(superpoly);
-        cv::convexHull(contour, contour);
-        superpoly = toQPolygonF(contour);
+        cv::convexHull(points, hull);
+        QPolygonF superpoly = toQPolygonF(hull);
 
         addContour(superpoly, layerName, true);
     }
 
+    saveData();
     updateViews();
 }
 
@@ -688,13 +1595,13 @@ void SnapshotModel::clearContours(QRectF rect)
     // collect selected contours
     foreach_item(QGraphicsPolygonItem *, pi, m_scene->items(rect,Qt::ContainsItemShape)) {
         QString layerName = pi->parentItem()->data(ITEM_FULLNAME).toString();
-        cv::Mat mask = getMatrix(layerName);
-        // erase the polygon from the mask: it's more reliable to flood fill than draw a contour, so
+        // erase the polygon from the mask: it's more reliable to remove the connected blob than draw a contour, so
         cv::Point seed = toCv( pi->polygon()[0] );
-        cv::floodFill( mask, seed, cv::Scalar(0), 0, cv::Scalar(), cv::Scalar(), 4 | cv::FLOODFILL_FIXED_RANGE);
+        removeFromMask( layerName, mask(layerName).component( seed ) );
         delete pi;
     }
 
+    saveData();
     updateViews();
 }
 
@@ -704,14 +1611,18 @@ QList< QPolygon >  SnapshotModel::detectContours(const QString &maskAndLayerName
                                                  cv::Rect maskROI,
                                                  int simple)
 {
-    if (!m_matrices.contains(maskAndLayerName))
+    if (!m_masks.contains(maskAndLayerName) && !m_labelMasks.contains(maskAndLayerName))
         return QList< QPolygon >();
-
-    cv::Mat mask = getMatrix(maskAndLayerName);
-    if (maskROI.width)
-        mask = cv::Mat(mask, maskROI);
+    QArtm::ScopedTimer timer("contours.detect");
+
+    // rasterize the roi into a scratch buffer, findContours corrupts it
+    const RunLengthMask& layerMask = mask(maskAndLayerName);
+    cv::Mat mask = m_scratch.get( "contours",
+                                  maskROI.width ? maskROI.size() : layerMask.size(),
+                                  CV_8UC1 );
+    layerMask.toMat( mask, maskROI );
     std::vector< std::vector< cv::Point > > contours;
-    cv::findContours(mask.clone(), // clone because findContours corrupts the mask
+    cv::findContours(mask,
                      contours,
                      CV_RETR_EXTERNAL,
                      CV_CHAIN_APPROX_TC89_L1,
@@ -746,10 +1657,16 @@ void SnapshotModel::addContour(const QPolygonF &contour, const QString &name, bo
     QGraphicsPolygonItem * poly_item = new QGraphicsPolygonItem( contour, layer(name) );
     poly_item->setPen(m_pens["counted"]);
     if (paintToMask) {
-        cv::Mat mask = getMatrix(name);
+        cv::Size frame = mask(name).size();
         std::vector< std::vector< cv::Point > > contours;
         contours.push_back(toCvInt(contour ));
-        cv::fillPoly( mask, contours, cv::Scalar(255) );
+        // paint the bounding box of the contour only and merge it into the mask
+        cv::Rect bounds = cv::boundingRect( contours[0] ) & cv::Rect( cv::Point(), frame );
+        if (bounds.area() > 0) {
+            cv::Mat patch( bounds.size(), CV_8UC1, cv::Scalar(0) );
+            cv::fillPoly( patch, contours, cv::Scalar(255), 8, 0, -bounds.tl() );
+            addToMask( name, RunLengthMask::fromMat( patch, frame, bounds.tl() ) );
+        }
     }
 }
 
@@ -759,22 +1676,26 @@ void SnapshotModel::submitCounts()
     // v is pink
     // u is green
     // o is yellow
+    // any other color goes by its name
+    static QMap< QString, QString > params;
+    if (params.isEmpty()) {
+        params["pink"] = "v";
+        params["green"] = "u";
+        params["yellow"] = "o";
+    }
 
-    QUrl url( QString("%1?f=command_vc&v=%2&u=%3&o=%4")
+    QString query = "f=command_vc";
+    foreach(QString color, s_colorNames)
+        query += QString("&%1=%2")
+                .arg( params.value(color, color) )
+                .arg( uiValue(color + "Count", "text").toInt() );
+    QUrl url( QString("%1?%2")
               .arg( uiValue("heckleUrl", "text").toString() )
-              .arg( uiValue("pinkCount", "text").toInt()    )
-              .arg( uiValue("greenCount", "text").toInt()   )
-              .arg( uiValue("yellowCount", "text").toInt()  ) );
+              .arg( query ) );
 
-    qDebug()
-        << "Submitting counts to: "
-        << url;
-    m_networkManager->get( QNetworkRequest(url) );
-}
-
-void SnapshotModel::on_http_finished(QNetworkReply *reply)
-{
-    if (reply->error() != QNetworkReply::NoError)
-        qDebug() << "HTTP Error: " << reply->error();
-    reply->deleteLater();
+    // the shell's queue sends the latest counts once they settle
+    QArtm::SubmissionQueue * queue = parent()
+            ? parent()->findChild< QArtm::SubmissionQueue * >("submissions") : 0;
+    if (queue)
+        queue->submit(url);
 }
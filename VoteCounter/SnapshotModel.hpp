@@ -5,6 +5,10 @@
 #include <QtGui>
 #include <opencv2/flann/flann.hpp>
 
+#include "RunLengthMask.hpp"
+#include "ScratchArena.hpp"
+#include "ColorHistogram.hpp"
+
 class MouseLogic;
 
 typedef QSet< QString > QStringSet;
@@ -25,20 +29,78 @@ public:
         POLYGONS_CONTOUR
     };
 
-    static const int COLOR_GRADATIONS = 5;
+    // card colors and palette gradations of each, for all the models.
+    // The palette has to fit the 8 bit indices, so gradations may be cut.
+    static void configureColors(const QStringList& names, int gradations);
+    static const QStringList& colorNames() { return s_colorNames; }
+    static int colorGradations() { return s_colorGradations; }
 
-    explicit SnapshotModel(const QString& path, QObject *parent);
+    // parameters override the values of the UI widgets with the same
+    // names (sizeLimit, pickFuzz, colorDiffThreshold, sizeFilter ...), a
+    // model without a parent runs on them alone
+    explicit SnapshotModel(const QString& path, QObject *parent, const QVariantMap& parameters = QVariantMap());
     ~SnapshotModel();
 
     QImage getImage(const QString& tag);
     cv::Mat getMatrix(const QString& tag);
     void setImage(const QString& tag, const QImage& img);
     void setMatrix(const QString& tag, const cv::Mat& matrix);
+    QArtm::RunLengthMask& mask(const QString& name);
+    // running Lab statistics of the training picks of a color
+    QArtm::ColorHistogram& trainStatistics(const QString& color);
+    // palette clustered from the training statistics, no pixel scan
+    cv::Mat paletteFromStatistics();
 
     QGraphicsScene * scene() { return m_scene; }
+
+    // connect to / disconnect from the UI, detached models are parentless
+    // and may be kept around for a quick comeback
+    void attach(QObject * ui);
+    void detach();
+    bool hasCounted() const { return m_matrices.contains("indices"); }
+    // when the cards on screen were counted
+    QDateTime countedAt() const { return m_countedAt; }
+    // bytes held by the model per "kind/name" (matrix/lab, image/input,
+    // mask/train.contours.green, pixmap/count.colorDiff ...), not while a
+    // background count writes the matrices
+    QMap< QString, qint64 > memoryReport() const;
+    // the usage from before a running count
+    qint64 memoryUsage() const;
+    // bytes held by all live models
+    static qint64 processMemoryUsage();
+    // drop products that are recomputed on demand, returns bytes freed
+    qint64 releaseRecomputable();
+
+    // part of the frame the audience sits in, in 0..1 frame coordinates,
+    // kept per snapshots directory; empty for the whole frame. Counting
+    // looks at nothing else.
+    QPolygonF audience() const { return m_audiencePolygon; }
+    void setAudience(const QPolygonF& polygon);
+    const QArtm::RunLengthMask& audienceMask() const { return m_audience; }
+
+    // classify only the tiles which differ from an earlier counted snapshot
+    // of the same scene and take the rest from its results, once
+    void reuseClassification(SnapshotModel& previous);
+
+    void setParameter(const QString& name, const QVariant& value);
+    int cardCount(const QString& color);
+
+    // the pipeline stages, one by one
+    void floodPickContour(int x, int y, int fuzz, const QString& layerName);
+    void classifyPixels();
+    // full resolution only where the coarse search isn't sure at the
+    // threshold, everywhere else with no threshold; pixels out of reach of
+    // the reject threshold aren't searched. The caller records the
+    // thresholds, this may run on a worker
+    void classifyPixels(int coarseThreshold, int rejectThreshold);
+    void computeColorDiff();
+    void countCards();
+
 signals:
     void willCount();
     void doneCounting();
+    void paletteChanged();
+    void audienceChanged();
 
 public slots:
     void setMode(Mode m);
@@ -64,7 +126,6 @@ public slots:
     void on_mouseLogic_rectUpdated(QRectF rect, Qt::MouseButton button, Qt::KeyboardModifiers mods);
     void on_mouseLogic_rectSelected(QRectF rect, Qt::MouseButton button, Qt::KeyboardModifiers mods);
     void on_countWatcher_finished();
-    void on_http_finished( QNetworkReply * reply );
 
     void submitCounts();
 
@@ -72,12 +133,77 @@ protected:
     static QStringSet s_cacheableImages;
     static QStringSet s_resizedImages;
     static QStringList s_colorNames;
+    static int s_colorGradations;
+    // card color of each palette index
+    static QVector< uchar > s_colorOfIndex;
     static QStringList s_persistentMasks;
+    static QStringList s_recomputableMatrices;
+    static QSet< SnapshotModel * > s_liveModels;
 
     QString m_originalPath;
+    QVariantMap m_parameters;
     QDir m_parentDir, m_cacheDir;
     QMap< QString, QImage > m_images;
     QMap< QString, cv::Mat > m_matrices;
+    // binary masks: train.contours.* and count.contours.*
+    QMap< QString, QArtm::RunLengthMask > m_masks;
+    // count.contours.* masks still to be made from the opened "labels"
+    QSet< QString > m_labelMasks;
+    QArtm::RunLengthMask labelMask(int label);
+    // results of an earlier snapshot for classifyPixels to reuse
+    struct Reuse {
+        QImage input;
+        cv::Mat indices, dists, paletteRGB;
+        QPolygonF audience;
+        int coarseThreshold, rejectThreshold;
+        int tolerance; // per channel, a pixel moving more changes its tile
+    };
+    QScopedPointer< Reuse > m_reuse;
+    static const int TILE = 64; // of reuse and refinement, the band height too
+    // tiles of a band with a pixel which differs from the reused input by
+    // more than the tolerance
+    QVector< bool > changedTiles(const cv::Mat& input, const cv::Mat& previous, int y, int rows, int tolerance);
+    // the coarse classification is sure of pixels closer to a card color
+    // than half the threshold or farther than twice it
+    static const int COARSE_SCALE = 4;
+    static const int COARSE_MARGIN = 2;
+    // the threshold the coarse results were refined for, -1 if there was
+    // no coarse pass
+    int m_coarseThreshold;
+    int coarseThreshold();
+    bool classifiedFor(int threshold) const;
+    void classifyCoarse(const cv::Mat& input, cv::Mat& indices, cv::Mat& dists);
+    // tiles of a band with a label boundary or a near threshold distance
+    QVector< bool > refinedTiles(const cv::Mat& coarseIndices, const cv::Mat& coarseDists,
+                                 int y, int rows, int cols, int nearDist, int farDist);
+    void reclassifyIfUnsure();
+    // the largest threshold the rejected pixels are certain for, -1 if
+    // none were
+    int m_rejectThreshold;
+    int rejectThreshold();
+    // per card color Lab boxes of the palette grown by the threshold
+    QVector< float > rejectionBoxes(int threshold);
+    // of a pixel, searched if it was rejected
+    int nearestIndex(int x, int y);
+    // Lab threshold in the units of the stored distances
+    static int scaledThreshold(double threshold);
+
+    // the audience polygon and its pixels
+    QPolygonF m_audiencePolygon;
+    QArtm::RunLengthMask m_audience;
+    // train.contours.* statistics kept up to date with the edits
+    QMap< QString, QArtm::ColorHistogram > m_trainStats;
+    // recycled full frame temporaries
+    QArtm::ScratchArena m_scratch;
+
+    // persistence bookkeeping of the masks
+    struct MaskState {
+        MaskState() : generation(0), dirty(false) {}
+        quint64 generation;
+        bool dirty;
+    };
+    QMap< QString, MaskState > m_maskState;
+    static quint64 s_maskGeneration;
 
     QGraphicsScene * m_scene;
     MouseLogic * m_mouseLogic;
@@ -88,28 +214,56 @@ protected:
     QMap< QString, QPen > m_pens;
     QMap< QString, QGraphicsItem *> m_layers;
     bool m_showColorDiff;
+    // UI values the current counts were made with
+    int m_countedThreshold, m_countedSizeFilter;
+    QDateTime m_countedAt;
+    bool m_palettePreviewDirty;
 
     typedef float ColorType;
     typedef cv::flann::L2<ColorType> ColorDistance;
+    // compact classification results: palette index per pixel and squared
+    // Lab distance to it in 1/DIST_SCALE units, saturated
+    typedef uchar IndexType;
+    typedef ushort DistType;
+    static const int DIST_SCALE = 8;
     cv::flann::GenericIndex< ColorDistance > * m_flann;
 
     QFutureWatcher<void> m_countWatcher;
-
-    QNetworkAccessManager * m_networkManager;
+    // background counts started and those whose results are in, each lands
+    // once whether it is waited for or reported by the watcher
+    int m_countsStarted, m_countsLanded;
+    // what memoryUsage() last found, it stands in while a count runs
+    mutable qint64 m_memoryUsage;
+    QElapsedTimer m_countTimer;
+    // blocks for a running count and takes its results in
+    void landCount();
 
     void updateViews();
     void saveData();
     void loadData();
+    void touchMask(const QString& name);
+    // mask edits, keeping persistence and statistics bookkeeping
+    void addToMask(const QString& name, const QArtm::RunLengthMask& region);
+    void removeFromMask(const QString& name, const QArtm::RunLengthMask& region);
     QGraphicsItem * layer(const QString& name);
     void showPalette();
+    void loadAudience();
+    void rasterizeAudience();
+    void showPalettePreview();
+    static cv::Mat labToRGB(const cv::Mat& paletteLab);
     void buildFlannRecognizer();
 
-    void classifyPixels();
-    void computeColorDiff();
-    void countCards();
+    // training pixels of one color and the palette gradations found in them
+    struct ColorTraining {
+        ColorTraining() : clusters(0) {}
+        cv::Mat sample;
+        cv::Mat centers;
+        int clusters;
+    };
+    cv::Mat collectTrainingPixels(const QArtm::RunLengthMask& mask, int cap);
+    static void clusterColor(ColorTraining& training);
 
     void addContour(const QPolygonF& contour, const QString& name, bool paintToMask = false);
-    void floodPickContour(int x, int y, int fuzz, const QString& layerName);
     QList< QPolygon > detectContours(const QString& maskAndLayerName, bool addToScene = true, cv::Rect maskROI = cv::Rect(), int simple = 1);
 
     template<typename PItem>
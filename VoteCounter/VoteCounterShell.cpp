@@ -1,6 +1,17 @@
 #include "VoteCounterShell.hpp"
 #include "SnapshotModel.hpp"
 #include "ScopedDetention.hpp"
+#include "ImageWriter.hpp"
+#include "Profiler.hpp"
+#include "ScopedTimer.hpp"
+#include "TraceRecorder.hpp"
+#include "LoggingHub.hpp"
+#include "InteractionRecorder.hpp"
+#include "MouseLogic.hpp"
+#include "PerformanceHud.hpp"
+#include "MetricsServer.hpp"
+#include "SubmissionQueue.hpp"
+#include "PolygonSelector.hpp"
 
 #include <QDir>
 #include <QListWidget>
@@ -8,38 +19,165 @@
 #include <QGraphicsView>
 #include <QRadioButton>
 #include <QButtonGroup>
+#include <QShortcut>
 
 QStringList VoteCounterShell::s_persistentObjectNames =
 QStringList() << "sizeLimit"
               << "pickFuzz"
               << "colorDiffThreshold"
               << "sizeFilter"
-              << "heckleUrl";
+              << "heckleUrl"
+              << "cacheBudget"
+              << "incremental"
+              << "coarseToFine";
 
 VoteCounterShell::VoteCounterShell(QWidget *parent) :
     QMainWindow(parent),
     m_snapshot(0),
+    m_cacheHits(0),
+    m_cacheMisses(0),
     m_lastWorkMode(0),
-    m_fsModel(new QFileSystemModel( this ))
+    m_fsModel(new QFileSystemModel( this )),
+    m_recorder(new QArtm::InteractionRecorder( this )),
+    m_hud(new QArtm::PerformanceHud)
 {
     m_fsModel->setObjectName("fsModel");
+    m_recorder->setObjectName("recorder");
+    // the snapshots send their counts through this one
+    QArtm::SubmissionQueue * submissions = new QArtm::SubmissionQueue( this );
+    submissions->setObjectName("submissions");
 
     m_waitDialog = new QMessageBox(this);
     m_waitDialog->setWindowTitle("Counting...");
     m_waitDialog->setText("Please wait while we count the cards");
     m_waitDialog->setStandardButtons(QMessageBox::NoButton);
     m_waitDialog->setWindowModality(Qt::WindowModal);
+
+    m_hud->setStages( QStringList() << "snapshot" << "load" << "train.pick" << "learn"
+                      << "count" << "count.classify" << "count.threshold" << "count.contours"
+                      << "save.write" << "submit" );
+    connect(m_hud, SIGNAL(aboutToRefresh()), SLOT(updateHud()));
+    QShortcut * hudShortcut = new QShortcut( QKeySequence(Qt::Key_F12), this );
+    connect(hudShortcut, SIGNAL(activated()), m_hud, SLOT(toggle()));
 }
 
 VoteCounterShell::~VoteCounterShell()
 {
     saveSettings();
-    if (m_snapshot)
-        delete m_snapshot;
+    dumpProfile();
+    // the scenes would take the overlay down with them
+    m_hud->showIn(0);
+    delete m_hud;
+    qDeleteAll(m_snapshotCache);
+    // let the background writer put everything on disk before we quit
+    QArtm::ImageWriter::instance()->stop();
+    QArtm::TraceRecorder::instance()->stop();
+}
+
+void VoteCounterShell::setupColors()
+{
+    // the card set lives in the settings, write the default out so there's
+    // something to edit
+    if (!m_settings.contains("colors"))
+        m_settings.setValue("colors", SnapshotModel::colorNames());
+    if (!m_settings.contains("colorGradations"))
+        m_settings.setValue("colorGradations", SnapshotModel::colorGradations());
+
+    QStringList colors = m_settings.value("colors").toStringList();
+    colors.removeAll(QString());
+    if (colors.isEmpty())
+        colors = SnapshotModel::colorNames();
+    SnapshotModel::configureColors( colors, m_settings.value("colorGradations").toInt() );
+
+    QButtonGroup * group = findChild<QButtonGroup*>("trainModeGroup");
+    QWidget * trainColors = findChild<QWidget*>("trainColors");
+    QWidget * trainCounts = findChild<QWidget*>("trainCounts");
+    QWidget * countColors = findChild<QWidget*>("countColors");
+    Q_ASSERT(group && trainColors && trainCounts && countColors);
+
+    // the form has widgets for the usual colors, hide the unused ones
+    foreach(QRadioButton * button, trainColors->findChildren<QRadioButton*>())
+        button->setVisible( colors.contains(button->text()) );
+    foreach(QLabel * label, trainCounts->findChildren<QLabel*>() + countColors->findChildren<QLabel*>())
+        label->setVisible( colors.contains(label->toolTip()) );
+
+    // and make the missing ones
+    foreach(QString color, colors) {
+        if (findChild<QObject*>(color + "TrainMode"))
+            continue;
+
+        QColor background( color );
+        QString style = background.isValid()
+                ? QString("background: \"%1\";").arg( background.lighter(160).name() )
+                : QString();
+
+        QRadioButton * button = new QRadioButton( color, trainColors );
+        button->setObjectName( color + "TrainMode" );
+        button->setSizePolicy( QSizePolicy::Preferred, QSizePolicy::Fixed );
+        trainColors->layout()->addWidget( button );
+        group->addButton( button );
+
+        QLabel * trainCount = new QLabel( "0", trainCounts );
+        trainCount->setObjectName( color + "TrainCount" );
+        trainCount->setToolTip( color );
+        trainCount->setStyleSheet( style );
+        trainCount->setAlignment( Qt::AlignCenter );
+        trainCount->setSizePolicy( QSizePolicy::MinimumExpanding, QSizePolicy::Preferred );
+        trainCounts->layout()->addWidget( trainCount );
+
+        QLabel * count = new QLabel( "0", countColors );
+        count->setObjectName( color + "Count" );
+        count->setToolTip( color );
+        count->setStyleSheet( style );
+        count->setAlignment( Qt::AlignCenter );
+        countColors->layout()->addWidget( count );
+    }
+
+    // train the first color unless the checked one is still there
+    if (!group->checkedButton() || !colors.contains(group->checkedButton()->text()))
+        findChild<QRadioButton*>( colors.first() + "TrainMode" )->setChecked(true);
 }
 
 void VoteCounterShell::loadSettings()
 {
+    setupColors();
+
+    // 0 shows everything, 1 warnings and worse, 2 only errors
+    QArtm::LoggingHub::setLevel( (QtMsgType)m_settings.value("logLevel", QtDebugMsg).toInt() );
+
+    // tracing is for the whole session, so it's only read at start
+    QString traceFile = m_settings.value("traceFile").toString();
+    if (!traceFile.isEmpty())
+        QArtm::TraceRecorder::instance()->start(traceFile);
+    // and so is the session recording
+    QString sessionFile = m_settings.value("sessionFile").toString();
+    if (!sessionFile.isEmpty() && m_recorder->start(sessionFile))
+        watchInteractions();
+
+    // how long the counts have to stay put before they are sent
+    findChild<QArtm::SubmissionQueue*>("submissions")->setDebounce( m_settings.value("submitDelay", 500).toInt() );
+
+    // the square the specks are opened away with, odd so it has a middle;
+    // the model reads it like the widgets
+    int openingSize = m_settings.value("openingSize", 3).toInt();
+    if (openingSize < 1 || openingSize % 2 == 0) {
+        qWarning() << "openingSize must be an odd number of pixels, not" << openingSize << "- using 3";
+        openingSize = 3;
+    }
+    QObject * opening = findChild<QObject*>("openingSize");
+    if (!opening) {
+        opening = new QObject(this);
+        opening->setObjectName("openingSize");
+    }
+    opening->setProperty("value", openingSize);
+
+    // numbers for the control desk, see README
+    int metricsPort = m_settings.value("metricsPort", 0).toInt();
+    if (metricsPort > 0) {
+        QArtm::MetricsServer * metrics = new QArtm::MetricsServer( "votecounter", this );
+        metrics->setObjectName("metrics");
+        metrics->listen( metricsPort );
+    }
 
     QGraphicsView * display = findChild<QGraphicsView*>("display");
     Q_ASSERT(display);
@@ -57,6 +195,10 @@ void VoteCounterShell::loadSettings()
             QVariant value = m_settings.value(name);
             if (value.isValid())
                 o->setProperty("value", value);
+        } else if (qobject_cast<QAbstractButton*>(o) && qobject_cast<QAbstractButton*>(o)->isCheckable()) {
+            QVariant value = m_settings.value(name);
+            if (value.isValid())
+                o->setProperty("checked", value);
         } else if ((o->metaObject()->indexOfProperty("text") >= 0)) {
             QVariant value = m_settings.value(name);
             if (value.isValid())
@@ -67,6 +209,16 @@ void VoteCounterShell::loadSettings()
     loadDir( m_settings.value("snaps_dir", QString()).toString() );
 }
 
+void VoteCounterShell::watchInteractions()
+{
+    foreach(QString name, QStringList() << "sizeLimit" << "pickFuzz" << "colorDiffThreshold" << "sizeFilter")
+        m_recorder->watchValue( findChild<QObject*>(name) );
+    foreach(QString name, QStringList() << "learn" << "count" << "resetLayer" << "colorDiffOn")
+        m_recorder->watchButton( findChild<QAbstractButton*>(name) );
+    foreach(QAbstractButton * button, findChild<QButtonGroup*>("trainModeGroup")->buttons())
+        m_recorder->watchButton( button );
+}
+
 void VoteCounterShell::saveSettings()
 {
     foreach(QString name, s_persistentObjectNames) {
@@ -79,6 +231,8 @@ void VoteCounterShell::saveSettings()
         if ((o->metaObject()->indexOfProperty("value") >= 0)
                 || (o->dynamicPropertyNames().contains("value"))) {
             m_settings.setValue(name, o->property("value"));
+        } else if (qobject_cast<QAbstractButton*>(o) && qobject_cast<QAbstractButton*>(o)->isCheckable()) {
+            m_settings.setValue(name, o->property("checked"));
         } else if ((o->metaObject()->indexOfProperty("text") >= 0)) {
             m_settings.setValue(name, o->property("text"));
         }
@@ -151,19 +305,65 @@ void VoteCounterShell::on_snapsList_clicked( const QModelIndex & index )
     QString dir = m_settings.value("snaps_dir").toString();
     loadSnapshot( dir + "/" + snap);
 
-    connect(m_snapshot, SIGNAL(willCount()), SLOT(willCount()));
-    connect(m_snapshot, SIGNAL(doneCounting()), SLOT(doneCounting()));
-
-    findChild<QPushButton*>("count")->animateClick();
+    // a snapshot coming back from the cache has been counted already
+    if (!m_snapshot->hasCounted())
+        findChild<QPushButton*>("count")->animateClick();
 }
 
 void VoteCounterShell::loadSnapshot(const QString &path)
 {
-    if (m_snapshot) delete m_snapshot;
-    m_snapshot = new SnapshotModel(path, this);
+    QArtm::ScopedTimer timer("snapshot");
+    if (QArtm::TraceRecorder::enabled()) {
+        QVariantMap args;
+        args["path"] = path;
+        QArtm::TraceRecorder::instance()->instant("snapshot", args);
+    }
+    // the same file scaled to a different size is a different snapshot
+    QString key = QString("%1@%2").arg(path).arg( findChild<QSpinBox*>("sizeLimit")->value() );
+
+    // an audience being edited belongs to the snapshot going away
+    findChild<QPushButton*>("editAudience")->setChecked(false);
+    if (m_snapshot) m_snapshot->detach();
+
+    SnapshotModel * previous = m_snapshot;
+    m_snapshot = m_snapshotCache.value(key);
+    if (m_snapshot) {
+        ++m_cacheHits;
+        QArtm::Profiler::instance()->count("snapshots.cache.hits");
+        m_snapshotOrder.removeAll(key);
+        m_snapshot->attach(this);
+    } else {
+        ++m_cacheMisses;
+        QArtm::Profiler::instance()->count("snapshots.cache.misses");
+        m_snapshot = new SnapshotModel(path, this);
+        m_snapshotCache[key] = m_snapshot;
+        connect(m_snapshot, SIGNAL(willCount()), SLOT(willCount()));
+        connect(m_snapshot, SIGNAL(doneCounting()), SLOT(doneCounting()));
+        connect(m_snapshot, SIGNAL(paletteChanged()), SLOT(dropSnapshotCache()));
+        connect(m_snapshot, SIGNAL(audienceChanged()), SLOT(dropSnapshotCache()));
+        // the camera hasn't moved, most of the hall looks the same
+        if (previous && previous->hasCounted() && findChild<QCheckBox*>("incremental")->isChecked())
+            m_snapshot->reuseClassification(*previous);
+    }
+    m_snapshotOrder << key;
+    QARTM_DEBUG << "Snapshot cache:" << m_cacheHits << "hits," << m_cacheMisses << "misses";
+    enforceMemoryBudget();
 
     QGraphicsView * display = findChild<QGraphicsView*>("display");
+    if (m_recorder->isRecording()) {
+        QVariantMap args;
+        args["path"] = path;
+        // the values the snapshot is made with
+        foreach(QString name, QStringList() << "sizeLimit" << "pickFuzz" << "colorDiffThreshold" << "sizeFilter" << "openingSize")
+            args[name] = findChild<QObject*>(name)->property("value");
+        args["coarseToFine"] = findChild<QCheckBox*>("coarseToFine")->isChecked();
+        m_recorder->record( "snapshot", args );
+        m_recorder->watch( m_snapshot->scene()->findChild<MouseLogic*>("mouseLogic") );
+    }
+
     display->setScene( m_snapshot->scene() );
+    m_hud->showIn( m_snapshot->scene() );
+    m_hud->setSnapshotTime( QFileInfo(path).lastModified() );
     display->fitInView( display->sceneRect(), Qt::KeepAspectRatio );
 
     recallLastWorkMode();
@@ -192,10 +392,20 @@ void VoteCounterShell::on_mode_currentChanged( int index )
     if (index == 0 || index == 1) {
         m_lastWorkMode = index;
     }
+    if (index != 1)
+        findChild<QPushButton*>("editAudience")->setChecked(false);
 
     if (!m_snapshot)
         return;
 
+    if (m_recorder->isRecording() && index < 2) {
+        QVariantMap args;
+        args["index"] = index;
+        if (index == 0)
+            args["color"] = findChild<QButtonGroup *>("trainModeGroup")->checkedButton()->text().toLower();
+        m_recorder->record( "mode", args );
+    }
+
     switch (index) {
     case 0: { // train
         QButtonGroup * grp = findChild<QButtonGroup *>("trainModeGroup");
@@ -210,6 +420,44 @@ void VoteCounterShell::on_mode_currentChanged( int index )
     }
 }
 
+void VoteCounterShell::on_editAudience_toggled( bool editing )
+{
+    QGraphicsView * display = findChild<QGraphicsView*>("display");
+    QWidget * viewport = display->viewport();
+    QArtm::PolygonSelector * selector = viewport->findChild<QArtm::PolygonSelector*>("audienceSelector");
+    if (!m_snapshot)
+        return;
+
+    // the selector works in 0..1 of the viewport, the model in 0..1 of the frame
+    cv::Size frame = m_snapshot->audienceMask().size();
+    if (editing && !selector) {
+        QPolygonF audience = m_snapshot->audience();
+        if (audience.isEmpty())
+            audience << QPointF(0, 0) << QPointF(0.5, 0) << QPointF(1, 0)
+                     << QPointF(1, 1) << QPointF(0.5, 1) << QPointF(0, 1);
+        QPolygonF onScreen;
+        foreach(QPointF p, audience) {
+            QPoint v = display->mapFromScene( p.x() * frame.width, p.y() * frame.height );
+            onScreen << QPointF( (qreal)v.x() / viewport->width(), (qreal)v.y() / viewport->height() );
+        }
+        selector = new QArtm::PolygonSelector( viewport );
+        selector->setObjectName("audienceSelector");
+        selector->setPolygon( onScreen );
+        selector->show();
+    } else if (!editing && selector) {
+        bool moved = selector->polygon() != selector->originalPolygon();
+        QPolygonF audience;
+        foreach(QPointF p, selector->polygon()) {
+            QPointF s = display->mapToScene( QPoint( p.x() * viewport->width(), p.y() * viewport->height() ) );
+            audience << QPointF( qBound( 0.0, s.x() / frame.width, 1.0 ),
+                                 qBound( 0.0, s.y() / frame.height, 1.0 ) );
+        }
+        delete selector;
+        if (moved)
+            m_snapshot->setAudience( audience );
+    }
+}
+
 void VoteCounterShell::recallLastWorkMode()
 {
     QTabWidget * mode = findChild<QTabWidget*>("mode");
@@ -226,4 +474,64 @@ void VoteCounterShell::willCount()
 void VoteCounterShell::doneCounting()
 {
     m_waitDialog->hide();
+    enforceMemoryBudget();
+    dumpProfile();
+    QArtm::TraceRecorder::instance()->flush();
+}
+
+void VoteCounterShell::updateHud()
+{
+    if (m_snapshot)
+        m_hud->setResultTime( m_snapshot->countedAt() );
+    m_hud->setMemoryUsage( SnapshotModel::processMemoryUsage() );
+}
+
+void VoteCounterShell::dumpProfile()
+{
+    // profiling results go where the settings say, if anywhere
+    QString path = m_settings.value("profileDump").toString();
+    if (!path.isEmpty())
+        QArtm::Profiler::instance()->dump(path);
+}
+
+void VoteCounterShell::enforceMemoryBudget()
+{
+    qint64 budget = (qint64)findChild<QSpinBox*>("cacheBudget")->value() * 1024 * 1024;
+    qint64 total = SnapshotModel::processMemoryUsage();
+    QArtm::Profiler::instance()->setGauge( "snapshots.cached", m_snapshotOrder.size() );
+    QArtm::Profiler::instance()->setGauge( "snapshots.memory_bytes", total );
+    if (total <= budget && m_snapshotOrder.size() <= MAX_CACHED_SNAPSHOTS)
+        return;
+
+    qDebug() << "Snapshots hold" << total / (1024*1024) << "MB, budget is" << budget / (1024*1024) << "MB";
+
+    // first drop what cached snapshots can recompute, least recently used first
+    for(int i = 0; i < m_snapshotOrder.size() - 1 && total > budget; ++i)
+        total -= m_snapshotCache[ m_snapshotOrder[i] ]->releaseRecomputable();
+
+    // then evict whole snapshots, but never the current one
+    while (m_snapshotOrder.size() > 1
+           && (total > budget || m_snapshotOrder.size() > MAX_CACHED_SNAPSHOTS)) {
+        SnapshotModel * evicted = m_snapshotCache.take( m_snapshotOrder.takeFirst() );
+        total -= evicted->memoryUsage();
+        delete evicted;
+    }
+
+    // and finally squeeze the current one
+    if (total > budget && m_snapshot)
+        total -= m_snapshot->releaseRecomputable();
+
+    if (total > budget)
+        qWarning() << "Current snapshot alone holds" << total / (1024*1024) << "MB, over the budget";
+}
+
+void VoteCounterShell::dropSnapshotCache()
+{
+    // cached snapshots were counted with an outdated palette
+    foreach(QString key, m_snapshotCache.keys()) {
+        if (m_snapshotCache[key] == m_snapshot)
+            continue;
+        delete m_snapshotCache.take(key);
+        m_snapshotOrder.removeAll(key);
+    }
 }
@@ -4,6 +4,7 @@
 #include <QMainWindow>
 
 class SnapshotModel;
+namespace QArtm { class InteractionRecorder; class PerformanceHud; }
 
 class VoteCounterShell : public QMainWindow
 {
@@ -23,23 +24,42 @@ public slots:
 
     void willCount();
     void doneCounting();
+    void dropSnapshotCache();
+    void updateHud();
 
     // automatically connected slots for children's signals
     void on_snapDirPicker_clicked();
     void on_snapsList_clicked ( const QModelIndex & index );
     void on_mode_currentChanged( int index );
     void on_fsModel_directoryLoaded(QString path);
+    void on_editAudience_toggled( bool editing );
 
 protected:
     SnapshotModel * m_snapshot;
+    // recently used snapshots, most recent last, the current one included
+    QMap< QString, SnapshotModel * > m_snapshotCache;
+    QStringList m_snapshotOrder;
+    int m_cacheHits, m_cacheMisses;
+    static const int MAX_CACHED_SNAPSHOTS = 16;
     int m_lastWorkMode;
     QSettings m_settings;
     QFileSystemModel * m_fsModel;
     QMessageBox * m_waitDialog;
     QString m_lastNewest;
+    // operator's actions, for replaying them headlessly
+    QArtm::InteractionRecorder * m_recorder;
+    // timings overlay of the current snapshot's scene
+    QArtm::PerformanceHud * m_hud;
 
     static QStringList s_persistentObjectNames;
 
+    void enforceMemoryBudget();
+    void dumpProfile();
+    // card colors from the settings, with their widgets
+    void setupColors();
+    // widgets and gestures of the session recording
+    void watchInteractions();
+
     virtual bool eventFilter(QObject *, QEvent *);
     QSet<QEvent*> m_eventFilterSentinel;
 
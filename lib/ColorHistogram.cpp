@@ -0,0 +1,127 @@
+#include "ColorHistogram.hpp"
+
+#include <cfloat>
+
+using namespace QArtm;
+
+ColorHistogram::ColorHistogram()
+    : m_total(0)
+{
+}
+
+void ColorHistogram::accumulate( const cv::Mat& image, const RunLengthMask& region, int weight )
+{
+    Q_ASSERT( image.type() == CV_8UC3 );
+    if (region.isEmpty())
+        return;
+    if (m_bins.isEmpty())
+        m_bins.resize(BINS);
+
+    const int shift = 8 - BITS;
+    Bin * bins = m_bins.data();
+    int rows = std::min( image.rows, region.rows() );
+    for(int y = 0; y < rows; ++y) {
+        const cv::Vec3b * row = image.ptr<cv::Vec3b>(y);
+        for(RunLengthMask::RunIterator run = region.rowBegin(y); run != region.rowEnd(y); ++run) {
+            for(int x = run->begin; x < run->end; ++x) {
+                const cv::Vec3b& p = row[x];
+                Bin& bin = bins[ ((p[0] >> shift) << (2*BITS))
+                               | ((p[1] >> shift) << BITS)
+                               | (p[2] >> shift) ];
+                bin.count += weight;
+                bin.sum[0] += (qint64)weight * p[0];
+                bin.sum[1] += (qint64)weight * p[1];
+                bin.sum[2] += (qint64)weight * p[2];
+            }
+            m_total += (qint64)weight * (run->end - run->begin);
+        }
+    }
+}
+
+void ColorHistogram::clear()
+{
+    m_bins.clear();
+    m_total = 0;
+}
+
+cv::Mat ColorHistogram::kmeans( int k, int iterations ) const
+{
+    if (isEmpty() || k < 1)
+        return cv::Mat();
+
+    // the occupied bins are the weighted points to cluster
+    QVector< cv::Vec3f > points;
+    QVector< float > weights;
+    foreach(const Bin& bin, m_bins) {
+        if (bin.count <= 0)
+            continue;
+        points << cv::Vec3f( (float)bin.sum[0] / bin.count,
+                             (float)bin.sum[1] / bin.count,
+                             (float)bin.sum[2] / bin.count );
+        weights << bin.count;
+    }
+
+    // deterministic k-means++ flavoured seeding: the heaviest bin first,
+    // then the bin with the largest weighted distance to the chosen ones
+    QVector< cv::Vec3f > centers;
+    QVector< float > nearest( points.size(), FLT_MAX );
+    int heaviest = 0;
+    for(int i = 1; i < points.size(); ++i)
+        if (weights[i] > weights[heaviest])
+            heaviest = i;
+    centers << points[heaviest];
+    while (centers.size() < k) {
+        int farthest = -1;
+        float farthestScore = 0;
+        for(int i = 0; i < points.size(); ++i) {
+            cv::Vec3f d = points[i] - centers.last();
+            nearest[i] = std::min( nearest[i], d.dot(d) );
+            if (nearest[i] * weights[i] > farthestScore) {
+                farthestScore = nearest[i] * weights[i];
+                farthest = i;
+            }
+        }
+        // fewer distinct colors than clusters: repeat the last one
+        centers << (farthest >= 0 ? points[farthest] : centers.last());
+    }
+
+    // Lloyd iterations
+    QVector< int > assignment( points.size(), -1 );
+    for(int iteration = 0; iteration < iterations; ++iteration) {
+        bool changed = false;
+        for(int i = 0; i < points.size(); ++i) {
+            int best = 0;
+            float bestDist = FLT_MAX;
+            for(int c = 0; c < k; ++c) {
+                cv::Vec3f d = points[i] - centers[c];
+                float dist = d.dot(d);
+                if (dist < bestDist) {
+                    bestDist = dist;
+                    best = c;
+                }
+            }
+            if (assignment[i] != best) {
+                assignment[i] = best;
+                changed = true;
+            }
+        }
+        if (!changed)
+            break;
+
+        QVector< cv::Vec3f > sums( k, cv::Vec3f(0,0,0) );
+        QVector< float > mass( k, 0 );
+        for(int i = 0; i < points.size(); ++i) {
+            sums[ assignment[i] ] += points[i] * weights[i];
+            mass[ assignment[i] ] += weights[i];
+        }
+        for(int c = 0; c < k; ++c)
+            if (mass[c] > 0) // an empty cluster keeps its center
+                centers[c] = sums[c] * (1.0f / mass[c]);
+    }
+
+    cv::Mat result( k, 3, CV_32FC1 );
+    for(int c = 0; c < k; ++c)
+        for(int j = 0; j < 3; ++j)
+            result.at<float>(c, j) = centers[c][j];
+    return result;
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include "RunLengthMask.hpp"
+
+namespace QArtm {
+
+// Running statistics of 8 bit color samples.
+//
+// Pixels are binned on the top BITS bits of each channel, every bin keeps
+// its count and the channel sums, so the mean of a bin is exact. Regions
+// can be added and removed again as the user edits them, and clustering
+// runs over the occupied bins instead of the pixels.
+class ColorHistogram {
+public:
+    static const int BITS = 5;
+    static const int BINS = 1 << (3 * BITS);
+
+    ColorHistogram();
+
+    // add (weight 1) or remove (weight -1) the pixels of a CV_8UC3 image
+    // under the region
+    void accumulate( const cv::Mat& image, const RunLengthMask& region, int weight = 1 );
+    void clear();
+    qint64 total() const { return m_total; }
+    bool isEmpty() const { return m_total <= 0; }
+    qint64 byteSize() const { return (qint64)m_bins.size() * sizeof(Bin); }
+
+    // weighted k-means over the occupied bins, k x 3 CV_32FC1 centers in
+    // image units, empty matrix if there are no samples
+    cv::Mat kmeans( int k, int iterations = 10 ) const;
+
+protected:
+    struct Bin {
+        Bin() : count(0) { sum[0] = sum[1] = sum[2] = 0; }
+        int count;
+        qint64 sum[3]; // count times 255 outgrows an int
+    };
+
+    QVector< Bin > m_bins; // allocated on first use
+    qint64 m_total;
+};
+
+}
@@ -0,0 +1,144 @@
+#include "ImageWriter.hpp"
+#include "ScopedTimer.hpp"
+
+#include <cstdio>
+
+using namespace QArtm;
+
+ImageWriter * ImageWriter::s_instance = 0;
+
+ImageWriter * ImageWriter::instance()
+{
+    if (!s_instance) {
+        s_instance = new ImageWriter;
+        s_instance->start( QThread::LowPriority );
+    }
+    return s_instance;
+}
+
+ImageWriter::ImageWriter()
+    : m_busy(false), m_finish(false)
+{
+    setObjectName("image writer");
+}
+
+ImageWriter::~ImageWriter()
+{
+    stop();
+}
+
+void ImageWriter::write( const QString& path, const cv::Mat& image, quint64 generation )
+{
+    QMutexLocker lock(&m_mutex);
+    QMap< QString, Job >::iterator queued = m_queue.find(path);
+    if (queued != m_queue.end() && queued.value().generation > generation)
+        return; // a newer version is already waiting
+
+    Job job;
+    job.image = image;
+    job.generation = generation;
+    m_queue[path] = job;
+    m_wakeup.wakeOne();
+}
+
+bool ImageWriter::pending( const QString& path, cv::Mat * image ) const
+{
+    QMutexLocker lock(&m_mutex);
+    const Job * job = 0;
+    if (m_queue.contains(path))
+        job = &m_queue.find(path).value();
+    else if (m_busy && m_currentPath == path)
+        job = &m_current;
+
+    if (job && image)
+        *image = job->image;
+    return job != 0;
+}
+
+int ImageWriter::queueDepth() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_queue.size() + (m_busy ? 1 : 0);
+}
+
+void ImageWriter::flush()
+{
+    QMutexLocker lock(&m_mutex);
+    while (isRunning() && (m_busy || !m_queue.isEmpty()))
+        m_idle.wait(&m_mutex);
+}
+
+void ImageWriter::stop()
+{
+    {
+        QMutexLocker lock(&m_mutex);
+        m_finish = true;
+        m_wakeup.wakeAll();
+    }
+    wait();
+}
+
+void ImageWriter::run()
+{
+    forever {
+        {
+            QMutexLocker lock(&m_mutex);
+            m_busy = false;
+            m_currentPath = QString();
+            m_current = Job();
+
+            while (m_queue.isEmpty() && !m_finish) {
+                m_idle.wakeAll();
+                m_wakeup.wait(&m_mutex);
+            }
+            if (m_queue.isEmpty()) {
+                // finishing and nothing left to write
+                m_idle.wakeAll();
+                return;
+            }
+
+            QMap< QString, Job >::iterator next = m_queue.begin();
+            m_currentPath = next.key();
+            m_current = next.value();
+            m_queue.erase(next);
+            m_busy = true;
+        }
+
+        store( m_currentPath, m_current.image );
+    }
+}
+
+void ImageWriter::store( const QString& path, const cv::Mat& image )
+{
+    ScopedTimer timer("save.write");
+    if (image.empty()) {
+        if (QFile::exists(path) && !QFile::remove(path))
+            qWarning() << "Couldn't remove" << path;
+        return;
+    }
+
+    // cv::imwrite picks the format by extension, so keep it on the temp file
+    QFileInfo fi(path);
+    QString tmp = fi.dir().filePath( "." + fi.completeBaseName() + ".writing." + fi.suffix() );
+
+    try {
+        if (!cv::imwrite( tmp.toStdString(), image )) {
+            qWarning() << "Couldn't write" << tmp;
+            QFile::remove(tmp);
+            return;
+        }
+    } catch (const cv::Exception& e) {
+        qWarning() << "Couldn't write" << tmp << ":" << e.what();
+        QFile::remove(tmp);
+        return;
+    }
+
+    // rename atomically replaces the target on POSIX, elsewhere fall back
+    // to remove + rename
+    if (std::rename( QFile::encodeName(tmp).constData(),
+                     QFile::encodeName(path).constData() ) != 0) {
+        QFile::remove(path);
+        if (!QFile::rename(tmp, path))
+            qWarning() << "Couldn't move" << tmp << "to" << path;
+    }
+}
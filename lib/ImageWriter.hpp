@@ -0,0 +1,51 @@
+#pragma once
+
+namespace QArtm {
+
+// Writes images to disk on a background thread.
+//
+// Repeated writes to the same path are coalesced: only the newest
+// generation waiting in the queue is written. Images are written to a
+// temporary sibling file and renamed into place, so a crash never leaves
+// a half-written file behind.
+class ImageWriter : public QThread {
+public:
+    static ImageWriter * instance();
+
+    // queue the image for writing, an empty image removes the file
+    void write( const QString& path, const cv::Mat& image, quint64 generation );
+    void remove( const QString& path, quint64 generation )
+    { write( path, cv::Mat(), generation ); }
+
+    // true if there is a write for path which hasn't reached the disk yet,
+    // the image to be written is then returned in image
+    bool pending( const QString& path, cv::Mat * image = 0 ) const;
+    int queueDepth() const;
+
+    // block until all queued images are on disk
+    void flush();
+    // flush and finish the thread
+    void stop();
+
+protected:
+    ImageWriter();
+    virtual ~ImageWriter();
+    void run();
+    void store( const QString& path, const cv::Mat& image );
+
+    struct Job {
+        cv::Mat image;
+        quint64 generation;
+    };
+
+    mutable QMutex m_mutex;
+    QWaitCondition m_wakeup, m_idle;
+    QMap< QString, Job > m_queue;
+    QString m_currentPath;
+    Job m_current;
+    bool m_busy, m_finish;
+
+    static ImageWriter * s_instance;
+};
+
+}
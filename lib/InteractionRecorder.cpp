@@ -0,0 +1,151 @@
+#include "InteractionRecorder.hpp"
+#include "MouseLogic.hpp"
+
+#include <qt-json/json.h>
+
+using namespace QArtm;
+
+InteractionRecorder::InteractionRecorder( QObject * parent )
+    : QObject(parent)
+{
+}
+
+InteractionRecorder::~InteractionRecorder()
+{
+    stop();
+}
+
+bool InteractionRecorder::start( const QString& path )
+{
+    stop();
+
+    m_file.setFileName(path);
+    if (!m_file.open(QFile::WriteOnly | QFile::Truncate)) {
+        qWarning() << "Couldn't write the session to" << path;
+        return false;
+    }
+    m_clock.start();
+    qDebug() << "Recording the session to" << path;
+    return true;
+}
+
+void InteractionRecorder::stop()
+{
+    if (m_file.isOpen())
+        m_file.close();
+}
+
+void InteractionRecorder::watch( MouseLogic * mouseLogic )
+{
+    connect( mouseLogic, SIGNAL(pointClicked(QPointF,Qt::MouseButton,Qt::KeyboardModifiers)),
+             SLOT(pointClicked(QPointF,Qt::MouseButton,Qt::KeyboardModifiers)), Qt::UniqueConnection );
+    connect( mouseLogic, SIGNAL(rectSelected(QRectF,Qt::MouseButton,Qt::KeyboardModifiers)),
+             SLOT(rectSelected(QRectF,Qt::MouseButton,Qt::KeyboardModifiers)), Qt::UniqueConnection );
+}
+
+void InteractionRecorder::watchValue( QObject * widget )
+{
+    connect( widget, SIGNAL(valueChanged(int)), SLOT(valueChanged(int)), Qt::UniqueConnection );
+    if (qobject_cast< QAbstractSlider * >(widget)) {
+        connect( widget, SIGNAL(sliderPressed()), SLOT(pressed()), Qt::UniqueConnection );
+        connect( widget, SIGNAL(sliderReleased()), SLOT(released()), Qt::UniqueConnection );
+    }
+}
+
+void InteractionRecorder::watchButton( QAbstractButton * button )
+{
+    connect( button, SIGNAL(clicked()), SLOT(clicked()), Qt::UniqueConnection );
+    connect( button, SIGNAL(pressed()), SLOT(pressed()), Qt::UniqueConnection );
+    connect( button, SIGNAL(released()), SLOT(released()), Qt::UniqueConnection );
+}
+
+void InteractionRecorder::record( const QString& type, const QVariantMap& args )
+{
+    if (!m_file.isOpen())
+        return;
+
+    QVariantMap event = args;
+    event["t"] = m_clock.elapsed();
+    event["type"] = type;
+    m_file.write( QtJson::serialize(event) );
+    m_file.write( "\n" );
+    m_file.flush();
+}
+
+QList< QVariantMap > InteractionRecorder::load( const QString& path )
+{
+    QList< QVariantMap > events;
+    QFile file(path);
+    if (!file.open(QFile::ReadOnly)) {
+        qWarning() << "Couldn't read the session from" << path;
+        return events;
+    }
+
+    int line = 0;
+    while (!file.atEnd()) {
+        ++line;
+        QString text = QString::fromUtf8( file.readLine() ).trimmed();
+        if (text.isEmpty())
+            continue;
+        bool ok = false;
+        QVariantMap event = QtJson::parse( text, ok ).toMap();
+        if (!ok || !event.contains("type")) {
+            qWarning() << "Skipping line" << line << "of" << path;
+            continue;
+        }
+        events << event;
+    }
+    return events;
+}
+
+void InteractionRecorder::pointClicked( QPointF point, Qt::MouseButton button, Qt::KeyboardModifiers mods )
+{
+    QVariantMap args;
+    args["x"] = point.x();
+    args["y"] = point.y();
+    args["button"] = (int)button;
+    args["mods"] = (int)mods;
+    record( "point", args );
+}
+
+void InteractionRecorder::rectSelected( QRectF rect, Qt::MouseButton button, Qt::KeyboardModifiers mods )
+{
+    QVariantMap args;
+    args["x"] = rect.x();
+    args["y"] = rect.y();
+    args["width"] = rect.width();
+    args["height"] = rect.height();
+    args["button"] = (int)button;
+    args["mods"] = (int)mods;
+    record( "rect", args );
+}
+
+void InteractionRecorder::valueChanged( int value )
+{
+    QVariantMap args;
+    args["name"] = sender()->objectName();
+    args["value"] = value;
+    record( "value", args );
+}
+
+void InteractionRecorder::pressed()
+{
+    recordSender( "press" );
+}
+
+void InteractionRecorder::released()
+{
+    recordSender( "release" );
+}
+
+void InteractionRecorder::clicked()
+{
+    recordSender( "click" );
+}
+
+void InteractionRecorder::recordSender( const QString& type )
+{
+    QVariantMap args;
+    args["name"] = sender()->objectName();
+    record( type, args );
+}
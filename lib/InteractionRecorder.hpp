@@ -0,0 +1,54 @@
+#pragma once
+
+class MouseLogic;
+
+namespace QArtm {
+
+// Writes what the operator does to a session file, one JSON object a line:
+//
+//   {"t":1520,"type":"point","x":812.5,"y":300,"button":1,"mods":0}
+//   {"t":2210,"type":"value","name":"colorDiffThreshold","value":14}
+//
+// t is milliseconds since the recording started. Pointer gestures come from
+// MouseLogic (point, rect), widgets report value changes (value), slider
+// and button presses (press, release) and clicks (click). Anything else,
+// like a snapshot being loaded, goes in with record(). Lines are flushed as
+// they are written, so the session of a crashed run is complete.
+class InteractionRecorder : public QObject {
+    Q_OBJECT
+public:
+    explicit InteractionRecorder( QObject * parent = 0 );
+    virtual ~InteractionRecorder();
+
+    bool start( const QString& path );
+    void stop();
+    bool isRecording() const { return m_file.isOpen(); }
+
+    // gestures on a scene, watching the same one twice is harmless
+    void watch( MouseLogic * mouseLogic );
+    // value changes of a slider or spin box, presses of a slider
+    void watchValue( QObject * widget );
+    // clicks, presses and releases of a button
+    void watchButton( QAbstractButton * button );
+
+    void record( const QString& type, const QVariantMap& args = QVariantMap() );
+
+    // the events of a session file, in order
+    static QList< QVariantMap > load( const QString& path );
+
+protected slots:
+    void pointClicked( QPointF point, Qt::MouseButton button, Qt::KeyboardModifiers mods );
+    void rectSelected( QRectF rect, Qt::MouseButton button, Qt::KeyboardModifiers mods );
+    void valueChanged( int value );
+    void pressed();
+    void released();
+    void clicked();
+
+protected:
+    void recordSender( const QString& type );
+
+    QFile m_file;
+    QElapsedTimer m_clock;
+};
+
+}
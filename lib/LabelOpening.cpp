@@ -0,0 +1,60 @@
+#include "LabelOpening.hpp"
+
+using namespace QArtm;
+
+namespace {
+
+struct Band {
+    cv::Mat labels, opened;
+    cv::Mat kernel;
+    int begin, end; // rows of opened
+    int reach;      // rows of labels read above and below
+};
+
+void openBand( Band& band )
+{
+    int top = std::max( band.begin - band.reach, 0 ),
+        bottom = std::min( band.end + band.reach, band.labels.rows );
+    // a copy, so the filters see the frame border and not the rows beyond
+    cv::Mat labels = band.labels.rowRange( top, bottom ).clone();
+
+    // a single label under the square, or none; NONE is the largest label
+    cv::Mat lowest, highest, uniform;
+    cv::erode( labels, lowest, band.kernel );
+    cv::dilate( labels, highest, band.kernel );
+    cv::compare( lowest, highest, uniform, cv::CMP_NE );
+    lowest.setTo( cv::Scalar(LabelOpening::NONE), uniform );
+
+    // grown back: the squares of different labels can't meet, so the
+    // smallest label around is the only one
+    cv::Mat opened;
+    cv::erode( lowest, opened, band.kernel );
+    opened.rowRange( band.begin - top, band.end - top ).copyTo( band.opened.rowRange( band.begin, band.end ) );
+}
+
+}
+
+void LabelOpening::open( const cv::Mat& labels, cv::Mat& opened, int size )
+{
+    Q_ASSERT( labels.type() == CV_8UC1 );
+    Q_ASSERT( size <= 1 || size % 2 == 1 );
+    opened.create( labels.size(), CV_8UC1 );
+    if (size <= 1 || labels.empty()) {
+        labels.copyTo( opened );
+        return;
+    }
+
+    QVector< Band > bands;
+    for(int y = 0; y < labels.rows; y += BAND) {
+        Band band;
+        band.labels = labels;
+        band.opened = opened;
+        band.kernel = cv::getStructuringElement( cv::MORPH_RECT, cv::Size( size, size ) );
+        band.begin = y;
+        band.end = std::min( y + BAND, labels.rows );
+        // the erosion and the growing back reach half a square each
+        band.reach = 2 * (size / 2);
+        bands << band;
+    }
+    QtConcurrent::blockingMap( bands, openBand );
+}
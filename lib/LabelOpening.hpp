@@ -0,0 +1,26 @@
+#pragma once
+
+namespace QArtm {
+
+// Morphological opening of all the labels of a label image at once.
+//
+// A label image has one CV_8UC1 label per pixel, NONE where there is none,
+// so the labels are masks which don't overlap. A square opened label can't
+// touch another one, which makes the opening of every label one erosion
+// to the pixels whose square holds a single label followed by a minimum
+// filter, instead of an erosion and a dilation per label. Bands of rows are
+// opened in parallel, each with the rows around it the square reaches.
+class LabelOpening {
+public:
+    static const uchar NONE = 255;
+
+    // opened gets the labels of labels opened with a size x size square,
+    // size is odd so the square has a middle pixel, 1 leaves the labels as
+    // they are
+    static void open( const cv::Mat& labels, cv::Mat& opened, int size );
+
+protected:
+    static const int BAND = 128; // rows
+};
+
+}
@@ -1,17 +1,21 @@
 #include "LoggingHub.hpp"
 #include "Pretty.hpp"
 #include "Throttle.hpp"
-#include "LogMessageEvent.hpp"
 
 using namespace QArtm;
 
+volatile int LoggingHub::s_level = QtDebugMsg;
 QWeakPointer<LoggingHub> LoggingHub::singleton;
 
 LoggingHub::LoggingHub( QMainWindow * mainWindow )
-    : m_mainWindow(mainWindow)
+    : m_tail(0)
+    , m_mainWindow(mainWindow)
     , m_throttle(new Throttle(20))
     , m_maxLines(50)
 {
+    for(int i = 0; i < RING_SIZE; ++i)
+        m_ring[i].sequence = i;
+
     m_prevHandler = qInstallMsgHandler( &dispatchMessage );
 
     if (m_mainWindow) {
@@ -34,6 +38,9 @@ LoggingHub::LoggingHub( QMainWindow * mainWindow )
         m_logFormat.setFontFamily("Monaco");
         m_logFormat.setFontStyleHint(QFont::Monospace);
     }
+
+    connect( &m_drainTimer, SIGNAL(timeout()), SLOT(drain()) );
+    m_drainTimer.start( DRAIN_INTERVAL );
 }
 
 LoggingHub::~LoggingHub()
@@ -48,65 +55,115 @@ void LoggingHub::setup( QMainWindow * window )
     singleton = new LoggingHub( window );
 }
 
-bool LoggingHub::event ( QEvent * e )
+void LoggingHub::message(QtMsgType type, const char *raw)
 {
-    if (e->type() == (QEvent::Type)Event::LOG_MESSAGE) {
-        LogMessageEvent * lme = dynamic_cast<LogMessageEvent*>(e);
-        Q_ASSERT(lme);
-        message( lme->msgType(), qPrintable( lme->message() ) );
-        return true;
+    if (type == QtFatalMsg) {
+        // we're about to abort, no time for the ring
+        std::cerr << qPrintable( Pretty::timestamp() ) << " F: " << raw << "\n";
+        return;
     }
 
-    return QObject::event(e);
+    // claim a slot
+    int pos = m_head;
+    Slot * slot;
+    forever {
+        slot = &m_ring[ pos & (RING_SIZE - 1) ];
+        if (slot->sequence.testAndSetAcquire( pos, pos )) {
+            // free, try to take it
+            if (m_head.testAndSetOrdered( pos, pos + 1 ))
+                break;
+        } else if ((int)slot->sequence - pos < 0) {
+            // full, the GUI thread is behind
+            m_dropped.fetchAndAddRelaxed(1);
+            return;
+        }
+        pos = m_head;
+    }
+
+    slot->type = type;
+    slot->msecs = QDateTime::currentMSecsSinceEpoch();
+    qstrncpy( slot->text, raw, MESSAGE_SIZE );
+    // publish it
+    slot->sequence.fetchAndStoreRelease( pos + 1 );
 }
 
-void LoggingHub::message(QtMsgType type, const char *raw)
+void LoggingHub::drain()
 {
-    if (QThread::currentThread() != thread()) {
-        LogMessageEvent * event = new LogMessageEvent( type, raw );
-        QCoreApplication::postEvent( this, event );
+    QString lastMessage;
+    int count = 0;
+    for(; count < DRAIN_BATCH; ++count) {
+        Slot& slot = m_ring[ m_tail & (RING_SIZE - 1) ];
+        if (!slot.sequence.testAndSetAcquire( m_tail + 1, m_tail + 1 ))
+            break; // nothing more published
+
+        lastMessage = QString("[") + Pretty::timestamp( slot.msecs ) + "] "
+                + tag(slot.type) + ": " + slot.text;
+        show( slot.type, lastMessage );
+
+        // hand it back to the producers, one lap later
+        slot.sequence.fetchAndStoreRelease( m_tail + RING_SIZE );
+        ++m_tail;
+    }
+
+    int dropped = m_dropped.fetchAndStoreRelaxed(0);
+    if (dropped) {
+        lastMessage = QString("[") + Pretty::timestamp() + "] W: "
+                + QString("%1 messages dropped").arg(dropped);
+        show( QtWarningMsg, lastMessage );
+        ++count;
+    }
+
+    if (!count || !m_mainWindow)
         return;
+
+    // the costly widget updates once per batch
+    m_mainWindow.data()->statusBar()->showMessage(lastMessage);
+    int tooMuch = m_logView->document()->lineCount() - m_maxLines;
+    if (tooMuch > 0) {
+        QTextCursor kill( m_logView->document() );
+        kill.movePosition( QTextCursor::Down,
+                           QTextCursor::KeepAnchor,
+                           tooMuch );
+        kill.removeSelectedText();
+    }
+    m_logView->ensureCursorVisible();
+}
+
+QString LoggingHub::tag(QtMsgType type)
+{
+    switch(type) {
+        case QtDebugMsg:
+            return "I";
+        case QtWarningMsg:
+            return "W";
+        case QtCriticalMsg:
+            return "E";
+        case QtFatalMsg:
+            return "F";
     }
+    return "?";
+}
 
+void LoggingHub::show(QtMsgType type, const QString& message)
+{
     if (m_mainWindow) {
-        QString tag;
         QColor color;
         switch(type) {
             case QtDebugMsg:
-                tag = "I";
                 color = Qt::black;
                 break;
             case QtWarningMsg:
-                tag = "W";
                 color = Qt::darkYellow;
                 break;
             case QtCriticalMsg:
-                tag = "E";
-                color = Qt::red;
-                break;
             case QtFatalMsg:
-                tag = "F";
                 color = Qt::red;
                 break;
         }
 
-        QString message = QString("[") + Pretty::timestamp() + "] "
-            + tag + ": " + raw;
-        m_mainWindow.data()->statusBar()->showMessage(message);
         if (!m_lastLine.isNull()) {
             m_logFormat.setForeground( m_lastColor );
             m_logTailCursor.insertText( m_lastLine, m_logFormat );
-
-            int tooMuch = m_logView->document()->lineCount() - m_maxLines;
-            if (tooMuch > 0) {
-                QTextCursor kill( m_logView->document() );
-                kill.movePosition( QTextCursor::Down,
-                                   QTextCursor::KeepAnchor,
-                                   tooMuch );
-                kill.removeSelectedText();
-            }
-
-            m_logView->ensureCursorVisible();
             m_lastLine = "\n";
         }
         m_lastLine += message;
@@ -119,6 +176,8 @@ void LoggingHub::message(QtMsgType type, const char *raw)
 
 void LoggingHub::dispatchMessage(QtMsgType type, const char *msg)
 {
+    if (type < s_level && type != QtFatalMsg)
+        return;
     if (singleton)
         singleton.data()->message(type, msg);
 }
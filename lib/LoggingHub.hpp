@@ -4,21 +4,58 @@ namespace QArtm {
 
 class Throttle;
 
+// Debug output which costs a flag check when it is turned off at runtime
+// and nothing at all when built with QT_NO_DEBUG_OUTPUT
+#ifdef QT_NO_DEBUG_OUTPUT
+#define QARTM_DEBUG while (false) qDebug()
+#else
+#define QARTM_DEBUG if (!QArtm::LoggingHub::debugEnabled()) {} else qDebug()
+#endif
+
 class LoggingHub : public QWidget {
     Q_OBJECT
 public:
     static void setup( QMainWindow * window );
 
+    // messages below the level are dropped where they are made
+    static void setLevel( QtMsgType level ) { s_level = level; }
+    static QtMsgType level() { return (QtMsgType)s_level; }
+    static bool debugEnabled() { return s_level <= QtDebugMsg; }
+
+protected slots:
+    // show what the ring has collected since the last time
+    void drain();
+
 protected:
     LoggingHub( QMainWindow * mainWindow );
     virtual ~LoggingHub();
     void message(QtMsgType type, const char *msg);
+    void show(QtMsgType type, const QString& message);
+    static QString tag(QtMsgType type);
 
-    virtual bool event ( QEvent * e );
     virtual bool eventFilter ( QObject * watched, QEvent * event );
 
     static void dispatchMessage(QtMsgType type, const char *msg);
 
+    // Bounded multi producer ring of fixed size messages (after Vyukov):
+    // a slot's sequence says whose turn it is, producers claim a position
+    // with a compare and swap and publish the slot by advancing its
+    // sequence, the GUI thread is the only consumer.
+    static const int RING_SIZE = 1024; // a power of two
+    static const int MESSAGE_SIZE = 512;
+    struct Slot {
+        QAtomicInt sequence;
+        QtMsgType type;
+        qint64 msecs;
+        char text[MESSAGE_SIZE];
+    };
+    Slot m_ring[RING_SIZE];
+    QAtomicInt m_head, m_dropped;
+    int m_tail;
+    QTimer m_drainTimer;
+    static const int DRAIN_INTERVAL = 40; // ms
+    static const int DRAIN_BATCH = 256;
+
     QWeakPointer<QMainWindow> m_mainWindow;
     QtMsgHandler m_prevHandler;
     QString m_lastLine;
@@ -29,6 +66,7 @@ protected:
     QScopedPointer<Throttle> m_throttle;
     int m_maxLines;
 
+    static volatile int s_level;
     static QWeakPointer<LoggingHub> singleton;
 };
 
@@ -0,0 +1,125 @@
+#include "MetricsServer.hpp"
+#include "Profiler.hpp"
+#include "ImageWriter.hpp"
+
+using namespace QArtm;
+
+const double MetricsServer::BUCKET_BOUNDS[] = {
+    0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+};
+const int MetricsServer::BUCKET_COUNT = sizeof(BUCKET_BOUNDS) / sizeof(BUCKET_BOUNDS[0]);
+
+MetricsServer::MetricsServer( const QString& prefix, QObject * parent )
+    : QObject(parent)
+    , m_prefix(prefix)
+{
+    connect( &m_server, SIGNAL(newConnection()), SLOT(acceptConnection()) );
+}
+
+bool MetricsServer::listen( quint16 port )
+{
+    // the numbers are for the control desk through a tunnel, not the hall
+    if (!m_server.listen( QHostAddress::LocalHost, port )) {
+        qWarning() << "Couldn't serve metrics on port" << port << ":" << m_server.errorString();
+        return false;
+    }
+    qDebug() << "Serving metrics on" << QString("http://localhost:%1/metrics").arg( m_server.serverPort() );
+    return true;
+}
+
+void MetricsServer::acceptConnection()
+{
+    while (QTcpSocket * socket = m_server.nextPendingConnection()) {
+        connect( socket, SIGNAL(readyRead()), SLOT(readRequest()) );
+        connect( socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()) );
+    }
+}
+
+void MetricsServer::readRequest()
+{
+    QTcpSocket * socket = qobject_cast< QTcpSocket * >( sender() );
+    if (!socket)
+        return;
+
+    // wait for the whole header, the body of a GET doesn't matter
+    QByteArray request = socket->peek( MAX_REQUEST_SIZE );
+    if (!request.contains("\r\n\r\n") && request.size() < MAX_REQUEST_SIZE)
+        return;
+    socket->readAll();
+
+    QList< QByteArray > requestLine = request.left( request.indexOf("\r\n") ).split(' ');
+    QByteArray status, type, body;
+    if (requestLine.size() >= 2 && requestLine[0] == "GET"
+            && (requestLine[1] == "/metrics" || requestLine[1].startsWith("/metrics?"))) {
+        status = "200 OK";
+        type = "text/plain; version=0.0.4";
+        body = metrics();
+    } else {
+        status = "404 Not Found";
+        type = "text/plain";
+        body = "Try /metrics\n";
+    }
+
+    QByteArray response = "HTTP/1.0 " + status + "\r\n"
+            + "Content-Type: " + type + "\r\n"
+            + "Content-Length: " + QByteArray::number( body.size() ) + "\r\n"
+            + "Connection: close\r\n\r\n"
+            + body;
+    socket->write( response );
+    socket->disconnectFromHost();
+}
+
+QString MetricsServer::metricName( const QString& name ) const
+{
+    QString metric = m_prefix + "_" + name;
+    metric.replace( QRegExp("[^a-zA-Z0-9_]"), "_" );
+    return metric;
+}
+
+QByteArray MetricsServer::metrics() const
+{
+    Profiler * profiler = Profiler::instance();
+    // the process-wide queues are read at scrape time
+    profiler->setGauge( "writes.queued", ImageWriter::instance()->queueDepth() );
+    profiler->setGauge( "workers.busy", QThreadPool::globalInstance()->activeThreadCount() );
+
+    QString text;
+    QTextStream out( &text );
+
+    QString stages = metricName("stage_seconds");
+    out << "# HELP " << stages << " Time spent in each stage.\n"
+        << "# TYPE " << stages << " histogram\n";
+    foreach(const Profiler::Summary& summary, profiler->summaries()) {
+        QString label = QString("stage=\"%1\"").arg( summary.name );
+        qint64 total = 0;
+        int bin = 0;
+        for(int b = 0; b < BUCKET_COUNT; ++b) {
+            qint64 bound = (qint64)(BUCKET_BOUNDS[b] * 1e9);
+            for(; bin < summary.buckets.size() && Profiler::bucketUpperBound(bin) <= bound; ++bin)
+                total += summary.buckets[bin];
+            out << stages << "_bucket{" << label << ",le=\"" << BUCKET_BOUNDS[b] << "\"} " << total << "\n";
+        }
+        for(; bin < summary.buckets.size(); ++bin)
+            total += summary.buckets[bin];
+        out << stages << "_bucket{" << label << ",le=\"+Inf\"} " << total << "\n"
+            << stages << "_sum{" << label << "} " << summary.totalNs / 1e9 << "\n"
+            << stages << "_count{" << label << "} " << total << "\n";
+    }
+
+    QMap< QString, qint64 > counters = profiler->counters();
+    foreach(QString name, counters.keys()) {
+        QString metric = metricName(name) + "_total";
+        out << "# TYPE " << metric << " counter\n"
+            << metric << " " << counters[name] << "\n";
+    }
+
+    QMap< QString, qint64 > gauges = profiler->gauges();
+    foreach(QString name, gauges.keys()) {
+        QString metric = metricName(name);
+        out << "# TYPE " << metric << " gauge\n"
+            << metric << " " << gauges[name] << "\n";
+    }
+
+    out.flush();
+    return text.toUtf8();
+}
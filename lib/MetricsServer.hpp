@@ -0,0 +1,42 @@
+#pragma once
+
+namespace QArtm {
+
+// Serves the Profiler's numbers in the Prometheus text format.
+//
+// A tiny HTTP server on the loopback interface: GET /metrics answers with
+// every stage as a histogram in seconds, the counters with a _total suffix
+// and the gauges, names prefixed and dots turned into underscores. The
+// stage histograms are folded from the profiler's log scale bins, so a
+// duration may land one bucket up. Anything else gets a 404.
+//
+//   curl http://localhost:9090/metrics
+class MetricsServer : public QObject {
+    Q_OBJECT
+public:
+    explicit MetricsServer( const QString& prefix, QObject * parent = 0 );
+
+    bool listen( quint16 port );
+    quint16 port() const { return m_server.serverPort(); }
+    void close() { m_server.close(); }
+
+    // the whole page
+    QByteArray metrics() const;
+
+protected slots:
+    void acceptConnection();
+    void readRequest();
+
+protected:
+    QString metricName( const QString& name ) const;
+
+    QString m_prefix;
+    QTcpServer m_server;
+
+    // Prometheus' default buckets
+    static const double BUCKET_BOUNDS[];
+    static const int BUCKET_COUNT;
+    static const int MAX_REQUEST_SIZE = 8192;
+};
+
+}
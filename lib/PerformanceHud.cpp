@@ -0,0 +1,124 @@
+#include "PerformanceHud.hpp"
+#include "Profiler.hpp"
+#include "ImageWriter.hpp"
+#include "Pretty.hpp"
+
+using namespace QArtm;
+
+PerformanceHud::PerformanceHud( QGraphicsItem * parent )
+    : QGraphicsObject(parent)
+    , m_memoryUsage(0)
+{
+    // same size at any zoom, above everything, never in the way of picks
+    setFlag( ItemIgnoresTransformations );
+    setZValue( 1000 );
+    setAcceptedMouseButtons( Qt::NoButton );
+    setVisible( false );
+
+    m_refreshTimer.setInterval( REFRESH_INTERVAL );
+    connect( &m_refreshTimer, SIGNAL(timeout()), SLOT(refresh()) );
+}
+
+void PerformanceHud::showIn( QGraphicsScene * scene )
+{
+    if (this->scene() == scene)
+        return;
+    if (this->scene())
+        this->scene()->removeItem(this);
+    if (scene) {
+        scene->addItem(this);
+        setPos( scene->sceneRect().topLeft() );
+    }
+}
+
+void PerformanceHud::toggle()
+{
+    setVisible( !isVisible() );
+    if (isVisible()) {
+        refresh();
+        m_refreshTimer.start();
+    } else
+        m_refreshTimer.stop();
+}
+
+QString PerformanceHud::age( const QDateTime& time )
+{
+    if (!time.isValid())
+        return "-";
+    return Pretty::ms( time.msecsTo( QDateTime::currentDateTime() ) );
+}
+
+void PerformanceHud::refresh()
+{
+    emit aboutToRefresh();
+
+    QStringList lines;
+    lines << QString("%1 %2 %3 %4")
+             .arg( "stage", -18 ).arg( "last", 9 ).arg( "avg", 9 ).arg( "p95", 9 );
+
+    // one pass over the profiler for all the stages
+    QMap< QString, Profiler::Summary > summaries;
+    foreach(const Profiler::Summary& summary, Profiler::instance()->summaries())
+        summaries[summary.name] = summary;
+
+    foreach(QString stage, m_stages) {
+        const Profiler::Summary& summary = summaries[stage];
+        StageTiming& timing = m_timings[stage];
+        if (summary.count > timing.count) {
+            timing.lastMs = (summary.totalNs - timing.totalNs) / 1e6 / (summary.count - timing.count);
+            timing.averageMs = timing.averageMs < 0
+                    ? timing.lastMs
+                    : 0.75 * timing.averageMs + 0.25 * timing.lastMs;
+            timing.count = summary.count;
+            timing.totalNs = summary.totalNs;
+        }
+        if (!timing.count)
+            continue;
+        lines << QString("%1 %2 %3 %4")
+                 .arg( stage, -18 )
+                 .arg( Pretty::ns( timing.lastMs * 1e6 ), 9 )
+                 .arg( Pretty::ns( timing.averageMs * 1e6 ), 9 )
+                 .arg( Pretty::ns( summary.p95Ns ), 9 );
+    }
+
+    lines << ""
+          << QString("writes queued %1, workers busy %2/%3")
+             .arg( ImageWriter::instance()->queueDepth() )
+             .arg( QThreadPool::globalInstance()->activeThreadCount() )
+             .arg( QThreadPool::globalInstance()->maxThreadCount() )
+          << QString("snapshot taken %1 ago, counted %2 ago")
+             .arg( age(m_snapshotTime) ).arg( age(m_resultTime) )
+          << QString("snapshots hold %1 MB").arg( m_memoryUsage / (1024*1024) );
+
+    QFont font( "Monospace" );
+    font.setStyleHint( QFont::TypeWriter );
+    font.setPointSize( 9 );
+    QFontMetrics metrics( font );
+    int width = 0;
+    foreach(QString line, lines)
+        width = std::max( width, metrics.width(line) );
+    QSize size( width + 12, metrics.lineSpacing() * lines.size() + 8 );
+
+    if (size != m_pixmap.size())
+        prepareGeometryChange();
+    m_pixmap = QPixmap( size );
+    m_pixmap.fill( QColor(0, 0, 0, 160) );
+    QPainter painter( &m_pixmap );
+    painter.setFont( font );
+    painter.setPen( Qt::white );
+    for(int i = 0; i < lines.size(); ++i)
+        painter.drawText( 6, 4 + metrics.ascent() + i * metrics.lineSpacing(), lines[i] );
+    painter.end();
+
+    update();
+}
+
+QRectF PerformanceHud::boundingRect() const
+{
+    return QRectF( QPointF(), m_pixmap.size() );
+}
+
+void PerformanceHud::paint( QPainter * painter, const QStyleOptionGraphicsItem *, QWidget * )
+{
+    painter->drawPixmap( 0, 0, m_pixmap );
+}
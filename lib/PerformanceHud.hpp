@@ -0,0 +1,59 @@
+#pragma once
+
+namespace QArtm {
+
+// Overlay of the profiled stage timings for the operator.
+//
+// Shows, for each stage, the mean of the runs since the previous update
+// (last), the same smoothed over the recent updates (avg) and the p95 of
+// the session, then the images waiting to be written, the busy worker
+// threads, how old the snapshot and the counts on it are, and the memory
+// the snapshots hold. It draws at a fixed size in the view's top left
+// corner whatever the zoom. Hidden, it does nothing at all; shown, it
+// reads the Profiler twice a second and renders into a pixmap which the
+// scene just copies on repaints.
+class PerformanceHud : public QGraphicsObject {
+    Q_OBJECT
+public:
+    explicit PerformanceHud( QGraphicsItem * parent = 0 );
+
+    // stages to show, in this order
+    void setStages( const QStringList& stages ) { m_stages = stages; }
+    // when the snapshot was taken and when its counts were made
+    void setSnapshotTime( const QDateTime& time ) { m_snapshotTime = time; }
+    void setResultTime( const QDateTime& time ) { m_resultTime = time; }
+    void setMemoryUsage( qint64 bytes ) { m_memoryUsage = bytes; }
+
+    // move to the scene being displayed
+    void showIn( QGraphicsScene * scene );
+
+    virtual QRectF boundingRect() const;
+    virtual void paint( QPainter * painter, const QStyleOptionGraphicsItem * option, QWidget * widget );
+
+signals:
+    // time to bring the values set from outside up to date
+    void aboutToRefresh();
+
+public slots:
+    void toggle();
+    void refresh();
+
+protected:
+    struct StageTiming {
+        StageTiming() : count(0), totalNs(0), lastMs(0), averageMs(-1) {}
+        qint64 count, totalNs;
+        double lastMs, averageMs;
+    };
+    QMap< QString, StageTiming > m_timings;
+
+    QStringList m_stages;
+    QDateTime m_snapshotTime, m_resultTime;
+    qint64 m_memoryUsage;
+    QTimer m_refreshTimer;
+    QPixmap m_pixmap;
+
+    static const int REFRESH_INTERVAL = 500; // ms
+    static QString age( const QDateTime& time );
+};
+
+}
@@ -73,18 +73,24 @@ void PolygonSelector::mousePressEvent ( QMouseEvent * event )
     p.setY(p.y() / height());
 
     m_dragCorner = -1;
-    if (m_polygon.containsPoint(p, Qt::OddEvenFill)) {
-        // find closest corner...
-        float mind = -1.0;
-        for(int i = 0; i<m_polygon.size(); ++i) {
-            QPointF corner = m_polygon[i];
-            float d = (corner - p).manhattanLength();
-            if (mind<0 || mind > d) {
-                mind = d;
-                m_dragCorner = i;
-            }
+    // find closest corner...
+    float mind = -1.0;
+    int closest = -1;
+    for(int i = 0; i<m_polygon.size(); ++i) {
+        QPointF corner = m_polygon[i];
+        float d = (corner - p).manhattanLength();
+        if (mind<0 || mind > d) {
+            mind = d;
+            closest = i;
         }
     }
+    // ...from inside, or just outside of a corner on the edge of the widget
+    if (closest >= 0) {
+        QPointF offset = event->posF() - QPointF( m_polygon[closest].x() * width(),
+                                                  m_polygon[closest].y() * height() );
+        if (m_polygon.containsPoint(p, Qt::OddEvenFill) || offset.manhattanLength() < CORNER_REACH)
+            m_dragCorner = closest;
+    }
 }
 
 void PolygonSelector::mouseReleaseEvent ( QMouseEvent * event )
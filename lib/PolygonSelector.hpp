@@ -21,6 +21,7 @@ protected:
 
     QPolygonF m_polygon, m_original;
     int m_dragCorner;
+    static const int CORNER_REACH = 15; // pixels
 };
 
 }
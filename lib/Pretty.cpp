@@ -8,6 +8,12 @@ QString Pretty::timestamp(bool date)
         .toString( QString(date ? "yyyy-MM-dd " : "") + "hh:mm:ss.zzz");
 }
 
+QString Pretty::timestamp(qint64 msecsSinceEpoch, bool date)
+{
+    return QDateTime::fromMSecsSinceEpoch(msecsSinceEpoch)
+        .toString( QString(date ? "yyyy-MM-dd " : "") + "hh:mm:ss.zzz");
+}
+
 QString Pretty::ms(int total)
 {
     if (total < 1000) {
@@ -25,3 +31,11 @@ QString Pretty::ms(int total)
     int h = m / 60;
     return QString("%1h%2").arg(h).arg(m,2,10,QChar('0'));
 }
+
+QString Pretty::ns(qint64 total)
+{
+    if (total < 1000000) {
+        return QString("%1 us").arg(total / 1000);
+    }
+    return ms( total / 1000000 );
+}
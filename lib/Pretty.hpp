@@ -5,7 +5,10 @@ namespace QArtm {
 class Pretty {
 public:
     static QString timestamp(bool date=false);
+    static QString timestamp(qint64 msecsSinceEpoch, bool date=false);
     static QString ms(int milliseconds);
+    // sub-millisecond durations in microseconds, the rest like ms()
+    static QString ns(qint64 nanoseconds);
 };
 
 }
@@ -0,0 +1,266 @@
+#include "Profiler.hpp"
+
+#include <qt-json/json.h>
+
+using namespace QArtm;
+
+// QThreadStorage deletes what it holds when the thread finishes, the buffer
+// outlives it and goes to the next new thread
+class Profiler::ThreadSlot {
+public:
+    ThreadSlot( Profiler * profiler, ThreadBuffer * buffer )
+        : m_profiler(profiler), m_buffer(buffer) {}
+    ~ThreadSlot() { m_profiler->retire( m_buffer ); }
+    ThreadBuffer * buffer() const { return m_buffer; }
+protected:
+    Profiler * m_profiler;
+    ThreadBuffer * m_buffer;
+};
+
+Profiler * Profiler::s_instance = 0;
+
+Profiler * Profiler::instance()
+{
+    static QMutex creation;
+    QMutexLocker lock(&creation);
+    if (!s_instance)
+        s_instance = new Profiler;
+    return s_instance;
+}
+
+Profiler::Profiler()
+{
+}
+
+int Profiler::stage( const QString& name )
+{
+    QMutexLocker lock(&m_mutex);
+    QHash< QString, int >::const_iterator found = m_stageIds.find(name);
+    if (found != m_stageIds.end())
+        return found.value();
+
+    if (m_stageNames.size() >= MAX_STAGES) {
+        qWarning() << "Too many profiler stages, not recording" << name;
+        return -1;
+    }
+    int id = m_stageNames.size();
+    m_stageNames << name;
+    m_stageIds[name] = id;
+    return id;
+}
+
+void Profiler::record( int stage, qint64 nanoseconds )
+{
+    if (stage < 0 || stage >= MAX_STAGES)
+        return;
+
+    ThreadBuffer * buffer = threadBuffer();
+    StageCounters * counters = buffer->stages[stage];
+    if (!counters) {
+        counters = new StageCounters;
+        // only we write our slots, but readers must see it constructed
+        buffer->stages[stage].testAndSetRelease( 0, counters );
+    }
+
+    counters->buckets[ bucketOf(nanoseconds) ].fetchAndAddRelaxed(1);
+    counters->totalNs += nanoseconds;
+    if (nanoseconds > counters->maxNs)
+        counters->maxNs = nanoseconds;
+    counters->count.fetchAndAddRelease(1);
+}
+
+void Profiler::record( const QString& stage, qint64 nanoseconds )
+{
+    ThreadBuffer * buffer = threadBuffer();
+    QHash< QString, int >::const_iterator found = buffer->stageIds.find(stage);
+    int id;
+    if (found != buffer->stageIds.end()) {
+        id = found.value();
+    } else {
+        id = this->stage(stage);
+        buffer->stageIds[stage] = id;
+    }
+    record( id, nanoseconds );
+}
+
+Profiler::ThreadBuffer * Profiler::threadBuffer()
+{
+    if (m_slots.hasLocalData())
+        return m_slots.localData()->buffer();
+
+    ThreadBuffer * buffer;
+    {
+        QMutexLocker lock(&m_mutex);
+        if (!m_retired.isEmpty()) {
+            buffer = m_retired.takeLast();
+        } else {
+            buffer = new ThreadBuffer;
+            m_buffers << buffer;
+        }
+    }
+    m_slots.setLocalData( new ThreadSlot( this, buffer ) );
+    return buffer;
+}
+
+void Profiler::retire( ThreadBuffer * buffer )
+{
+    QMutexLocker lock(&m_mutex);
+    m_retired << buffer;
+}
+
+int Profiler::bucketOf( qint64 ns )
+{
+    if (ns < (1 << SUB_BITS))
+        return ns < 0 ? 0 : (int)ns;
+
+    int msb = 63;
+    while (!(ns >> msb))
+        --msb;
+    int shift = msb - SUB_BITS;
+    return ((shift + 1) << SUB_BITS) | (int)((ns >> shift) & ((1 << SUB_BITS) - 1));
+}
+
+qint64 Profiler::bucketValue( int bucket )
+{
+    if (bucket < (1 << SUB_BITS))
+        return bucket;
+
+    // middle of the bucket
+    int shift = (bucket >> SUB_BITS) - 1;
+    qint64 low = (qint64)((1 << SUB_BITS) | (bucket & ((1 << SUB_BITS) - 1))) << shift;
+    return low + ((qint64)1 << shift) / 2;
+}
+
+qint64 Profiler::bucketUpperBound( int bucket )
+{
+    if (bucket < (1 << SUB_BITS))
+        return bucket;
+
+    int shift = (bucket >> SUB_BITS) - 1;
+    qint64 low = (qint64)((1 << SUB_BITS) | (bucket & ((1 << SUB_BITS) - 1))) << shift;
+    return low + ((qint64)1 << shift) - 1;
+}
+
+QList< Profiler::Summary > Profiler::summaries() const
+{
+    QMutexLocker lock(&m_mutex);
+
+    QMap< QString, Summary > byName;
+    QVector< qint64 > histogram( BUCKETS );
+    for(int id = 0; id < m_stageNames.size(); ++id) {
+        Summary summary;
+        summary.name = m_stageNames[id];
+        histogram.fill(0);
+        foreach(ThreadBuffer * buffer, m_buffers) {
+            StageCounters * counters = buffer->stages[id];
+            if (!counters)
+                continue;
+            summary.count += (int)counters->count;
+            summary.totalNs += counters->totalNs;
+            summary.maxNs = std::max( summary.maxNs, counters->maxNs );
+            for(int b = 0; b < BUCKETS; ++b)
+                histogram[b] += (int)counters->buckets[b];
+        }
+        if (!summary.count)
+            continue;
+        summary.buckets = histogram;
+
+        // percentiles from the histogram counts, which may be ahead of the
+        // summed count while someone is recording
+        qint64 binned = 0;
+        for(int b = 0; b < BUCKETS; ++b)
+            binned += histogram[b];
+        qint64 seen = 0;
+        qint64 * targets[3] = { &summary.p50Ns, &summary.p95Ns, &summary.p99Ns };
+        double fractions[3] = { 0.50, 0.95, 0.99 };
+        int next = 0;
+        for(int b = 0; b < BUCKETS && next < 3; ++b) {
+            seen += histogram[b];
+            while (next < 3 && seen >= qCeil( fractions[next] * binned )) {
+                *targets[next] = std::min( bucketValue(b), summary.maxNs );
+                ++next;
+            }
+        }
+        byName[summary.name] = summary;
+    }
+    return byName.values();
+}
+
+Profiler::Summary Profiler::summary( const QString& stage ) const
+{
+    foreach(const Summary& summary, summaries())
+        if (summary.name == stage)
+            return summary;
+    Summary none;
+    none.name = stage;
+    return none;
+}
+
+void Profiler::count( const QString& name, qint64 increment )
+{
+    QMutexLocker lock(&m_mutex);
+    m_counters[name] += increment;
+}
+
+void Profiler::setGauge( const QString& name, qint64 value )
+{
+    QMutexLocker lock(&m_mutex);
+    m_gauges[name] = value;
+}
+
+QMap< QString, qint64 > Profiler::counters() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_counters;
+}
+
+QMap< QString, qint64 > Profiler::gauges() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_gauges;
+}
+
+QVariantMap Profiler::toVariant() const
+{
+    QVariantMap stages;
+    foreach(const Summary& summary, summaries()) {
+        QVariantMap stage;
+        stage["count"] = summary.count;
+        stage["total_ms"] = summary.totalNs / 1e6;
+        stage["mean_ms"] = summary.meanNs() / 1e6;
+        stage["max_ms"] = summary.maxNs / 1e6;
+        stage["p50_ms"] = summary.p50Ns / 1e6;
+        stage["p95_ms"] = summary.p95Ns / 1e6;
+        stage["p99_ms"] = summary.p99Ns / 1e6;
+        stages[summary.name] = stage;
+    }
+    QVariantMap counters, gauges;
+    QMap< QString, qint64 > values = this->counters();
+    foreach(QString name, values.keys())
+        counters[name] = values[name];
+    values = this->gauges();
+    foreach(QString name, values.keys())
+        gauges[name] = values[name];
+
+    QVariantMap result;
+    result["stages"] = stages;
+    result["counters"] = counters;
+    result["gauges"] = gauges;
+    return result;
+}
+
+QByteArray Profiler::toJson() const
+{
+    return QtJson::serialize( toVariant() );
+}
+
+bool Profiler::dump( const QString& path ) const
+{
+    QFile file(path);
+    if (!file.open(QFile::WriteOnly | QFile::Truncate)) {
+        qWarning() << "Couldn't write the profile to" << path;
+        return false;
+    }
+    file.write( toJson() );
+    return true;
+}
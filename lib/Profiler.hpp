@@ -0,0 +1,87 @@
+#pragma once
+
+namespace QArtm {
+
+// Latency histograms of named stages.
+//
+// Every thread records into its own buffer, so the recording path takes no
+// lock once the thread has seen the stage. Durations are binned on a log
+// scale with 4 bins per octave, which is good for percentiles within ~20%.
+// Summaries add the buffers of all the threads up.
+class Profiler {
+public:
+    static Profiler * instance();
+
+    // stage ids are stable for the life of the process
+    int stage( const QString& name );
+    void record( int stage, qint64 nanoseconds );
+    void record( const QString& stage, qint64 nanoseconds );
+
+    struct Summary {
+        Summary() : count(0), totalNs(0), maxNs(0), p50Ns(0), p95Ns(0), p99Ns(0) {}
+        QString name;
+        qint64 count;
+        qint64 totalNs, maxNs;
+        qint64 p50Ns, p95Ns, p99Ns;
+        QVector< qint64 > buckets; // counts of the histogram bins
+        qint64 meanNs() const { return count ? totalNs / count : 0; }
+    };
+    // stages recorded at least once, by name
+    QList< Summary > summaries() const;
+    Summary summary( const QString& stage ) const;
+    // longest duration that goes into a bin
+    static qint64 bucketUpperBound( int bucket );
+
+    // events counted up (snapshots.counted, submissions.failed ...) and
+    // levels set from time to time (snapshots.cached ...), for things
+    // which happen too rarely to need per thread buffers
+    void count( const QString& name, qint64 increment = 1 );
+    void setGauge( const QString& name, qint64 value );
+    QMap< QString, qint64 > counters() const;
+    QMap< QString, qint64 > gauges() const;
+
+    // {"stages": {"name": {"count":, "total_ms":, "mean_ms":, "max_ms":,
+    // "p50_ms":, "p95_ms":, "p99_ms":}}, "counters": {"name": n},
+    // "gauges": {"name": n}}
+    QVariantMap toVariant() const;
+    QByteArray toJson() const;
+    bool dump( const QString& path ) const;
+
+    static const int MAX_STAGES = 256;
+    static const int SUB_BITS = 2;
+    static const int BUCKETS = 64 << SUB_BITS;
+
+protected:
+    Profiler();
+
+    // written by the owning thread only, summaries read them racily: the
+    // counts are atomic, the totals may be a record behind
+    struct StageCounters {
+        StageCounters() : totalNs(0), maxNs(0) {}
+        QAtomicInt buckets[BUCKETS];
+        QAtomicInt count;
+        qint64 totalNs, maxNs;
+    };
+    struct ThreadBuffer {
+        QAtomicPointer< StageCounters > stages[MAX_STAGES];
+        QHash< QString, int > stageIds; // lookup cache of the owner
+    };
+    class ThreadSlot;
+
+    ThreadBuffer * threadBuffer();
+    void retire( ThreadBuffer * buffer );
+    static int bucketOf( qint64 ns );
+    static qint64 bucketValue( int bucket );
+
+    mutable QMutex m_mutex;
+    QStringList m_stageNames;
+    QHash< QString, int > m_stageIds;
+    // all buffers ever made and the ones whose thread has finished
+    QList< ThreadBuffer * > m_buffers, m_retired;
+    QThreadStorage< ThreadSlot * > m_slots;
+    QMap< QString, qint64 > m_counters, m_gauges;
+
+    static Profiler * s_instance;
+};
+
+}
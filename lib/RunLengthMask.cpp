@@ -0,0 +1,302 @@
+#include "RunLengthMask.hpp"
+
+#include <climits>
+
+using namespace QArtm;
+
+namespace {
+
+struct UnionOp {
+    static bool apply(bool a, bool b) { return a || b; }
+};
+
+struct SubtractOp {
+    static bool apply(bool a, bool b) { return a && !b; }
+};
+
+struct IntersectOp {
+    static bool apply(bool a, bool b) { return a && b; }
+};
+
+// sweep over the run boundaries of two rows and emit the runs where
+// Op holds
+template<class Op>
+void combineRow( RunLengthMask::RunIterator a, RunLengthMask::RunIterator aEnd,
+                 RunLengthMask::RunIterator b, RunLengthMask::RunIterator bEnd,
+                 QVector< RunLengthMask::Run >& out )
+{
+    bool inA = false, inB = false;
+    int openedAt = -1;
+    while (a != aEnd || b != bEnd) {
+        int nextA = (a != aEnd) ? (inA ? a->end : a->begin) : INT_MAX;
+        int nextB = (b != bEnd) ? (inB ? b->end : b->begin) : INT_MAX;
+        int pos = std::min(nextA, nextB);
+
+        if (nextA == pos) {
+            if (inA) ++a;
+            inA = !inA;
+        }
+        if (nextB == pos) {
+            if (inB) ++b;
+            inB = !inB;
+        }
+
+        bool in = Op::apply(inA, inB);
+        if (in && openedAt < 0) {
+            openedAt = pos;
+        } else if (!in && openedAt >= 0) {
+            out << RunLengthMask::Run( openedAt, pos );
+            openedAt = -1;
+        }
+    }
+}
+
+}
+
+RunLengthMask::RunLengthMask()
+    : m_rows(0), m_cols(0), m_rowStart(1, 0)
+{
+}
+
+RunLengthMask::RunLengthMask( int rows, int cols )
+    : m_rows(rows), m_cols(cols), m_rowStart(rows + 1, 0)
+{
+}
+
+RunLengthMask::RunLengthMask( cv::Size size )
+    : m_rows(size.height), m_cols(size.width), m_rowStart(size.height + 1, 0)
+{
+}
+
+RunLengthMask RunLengthMask::fromMat( const cv::Mat& mask, cv::Size frame, cv::Point offset )
+{
+    Q_ASSERT( mask.empty() || mask.type() == CV_8UC1 );
+    if (frame.width == 0 && frame.height == 0)
+        frame = mask.size();
+
+    RunLengthMask result(frame);
+    int x0 = std::max( 0, -offset.x ),
+        x1 = std::min( mask.cols, frame.width - offset.x );
+    for(int y = 0; y < frame.height; ++y) {
+        int my = y - offset.y;
+        if (my >= 0 && my < mask.rows) {
+            const uchar * p = mask.ptr<uchar>(my);
+            int x = x0;
+            while (x < x1) {
+                while (x < x1 && !p[x]) ++x;
+                if (x == x1) break;
+                int begin = x;
+                while (x < x1 && p[x]) ++x;
+                result.m_runs << Run( begin + offset.x, x + offset.x );
+            }
+        }
+        result.m_rowStart[y+1] = result.m_runs.size();
+    }
+    return result;
+}
+
+RunLengthMask RunLengthMask::fromSpans( QVector< Span > spans, cv::Size frame )
+{
+    qSort( spans );
+
+    RunLengthMask result(frame);
+    int y = 0;
+    foreach(const Span& span, spans) {
+        if (span.row < 0 || span.row >= frame.height)
+            continue;
+        int begin = std::max( 0, span.begin ), end = std::min( frame.width, span.end );
+        if (begin >= end)
+            continue;
+
+        // close the rows before this span
+        for(; y < span.row; ++y)
+            result.m_rowStart[y+1] = result.m_runs.size();
+
+        // merge with the previous run of the row if they touch
+        if (result.m_runs.size() > result.m_rowStart[y] && result.m_runs.last().end >= begin)
+            result.m_runs.last().end = std::max( result.m_runs.last().end, end );
+        else
+            result.m_runs << Run( begin, end );
+    }
+    for(; y < frame.height; ++y)
+        result.m_rowStart[y+1] = result.m_runs.size();
+
+    return result;
+}
+
+int RunLengthMask::area() const
+{
+    int area = 0;
+    foreach(const Run& run, m_runs)
+        area += run.end - run.begin;
+    return area;
+}
+
+cv::Rect RunLengthMask::boundingRect() const
+{
+    int top = -1, bottom = -1, left = INT_MAX, right = INT_MIN;
+    for(int y = 0; y < m_rows; ++y) {
+        if (rowBegin(y) == rowEnd(y))
+            continue;
+        if (top < 0) top = y;
+        bottom = y;
+        left = std::min( left, rowBegin(y)->begin );
+        right = std::max( right, (rowEnd(y) - 1)->end );
+    }
+    if (top < 0)
+        return cv::Rect();
+    return cv::Rect( left, top, right - left, bottom - top + 1 );
+}
+
+int RunLengthMask::findRun( int x, int y ) const
+{
+    if (y < 0 || y >= m_rows)
+        return -1;
+    // binary search for the last run starting at or before x
+    int lo = m_rowStart[y], hi = m_rowStart[y+1];
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (m_runs[mid].begin <= x)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo > m_rowStart[y] && m_runs[lo-1].end > x)
+        return lo - 1;
+    return -1;
+}
+
+bool RunLengthMask::contains( int x, int y ) const
+{
+    return findRun(x, y) >= 0;
+}
+
+qint64 RunLengthMask::byteSize() const
+{
+    return sizeof(*this)
+        + m_rowStart.capacity() * sizeof(int)
+        + m_runs.capacity() * sizeof(Run);
+}
+
+cv::Mat RunLengthMask::toMat( cv::Rect roi, uchar value ) const
+{
+    cv::Mat result;
+    toMat( result, roi, value );
+    return result;
+}
+
+void RunLengthMask::toMat( cv::Mat& dst, cv::Rect roi, uchar value ) const
+{
+    if (roi.width == 0 || roi.height == 0)
+        roi = cv::Rect( 0, 0, m_cols, m_rows );
+
+    dst.create( roi.height, roi.width, CV_8UC1 );
+    dst = cv::Scalar(0);
+
+    int y0 = std::max( 0, roi.y ), y1 = std::min( m_rows, roi.y + roi.height );
+    for(int y = y0; y < y1; ++y) {
+        uchar * p = dst.ptr<uchar>(y - roi.y);
+        for(RunIterator run = rowBegin(y); run != rowEnd(y); ++run) {
+            int begin = std::max( run->begin, roi.x ),
+                end = std::min( run->end, roi.x + roi.width );
+            if (begin < end)
+                memset( p + begin - roi.x, value, end - begin );
+        }
+    }
+}
+
+template<class Op>
+RunLengthMask RunLengthMask::combine( const RunLengthMask& a, const RunLengthMask& b )
+{
+    // a default constructed mask acts as an empty mask of any size
+    if (a.size() != b.size()) {
+        if (a.m_rows == 0 && a.m_cols == 0)
+            return combine<Op>( RunLengthMask(b.size()), b );
+        if (b.m_rows == 0 && b.m_cols == 0)
+            return combine<Op>( a, RunLengthMask(a.size()) );
+        qWarning() << "Combining masks of different sizes";
+        return a;
+    }
+
+    RunLengthMask result( a.m_rows, a.m_cols );
+    result.m_runs.reserve( a.m_runs.size() + b.m_runs.size() );
+    for(int y = 0; y < a.m_rows; ++y) {
+        combineRow<Op>( a.rowBegin(y), a.rowEnd(y), b.rowBegin(y), b.rowEnd(y), result.m_runs );
+        result.m_rowStart[y+1] = result.m_runs.size();
+    }
+    return result;
+}
+
+RunLengthMask RunLengthMask::united( const RunLengthMask& other ) const
+{
+    if (other.isEmpty() && (other.size() == size() || other.m_rows == 0))
+        return *this;
+    return combine<UnionOp>( *this, other );
+}
+
+RunLengthMask RunLengthMask::subtracted( const RunLengthMask& other ) const
+{
+    if (other.isEmpty() || isEmpty())
+        return *this;
+    return combine<SubtractOp>( *this, other );
+}
+
+RunLengthMask RunLengthMask::intersected( const RunLengthMask& other ) const
+{
+    return combine<IntersectOp>( *this, other );
+}
+
+RunLengthMask RunLengthMask::roi( cv::Rect roi ) const
+{
+    RunLengthMask result( roi.height, roi.width );
+    for(int ry = 0; ry < roi.height; ++ry) {
+        int y = ry + roi.y;
+        if (y >= 0 && y < m_rows) {
+            for(RunIterator run = rowBegin(y); run != rowEnd(y); ++run) {
+                int begin = std::max( run->begin, roi.x ),
+                    end = std::min( run->end, roi.x + roi.width );
+                if (begin < end)
+                    result.m_runs << Run( begin - roi.x, end - roi.x );
+            }
+        }
+        result.m_rowStart[ry+1] = result.m_runs.size();
+    }
+    return result;
+}
+
+RunLengthMask RunLengthMask::component( cv::Point seed ) const
+{
+    int first = findRun( seed.x, seed.y );
+    if (first < 0)
+        return RunLengthMask( size() );
+
+    // walk the graph of runs overlapping in the neighbouring rows
+    QVector< bool > taken( m_runs.size(), false );
+    QVector< QPair<int,int> > stack; // (row, run index)
+    QVector< Span > spans;
+
+    taken[first] = true;
+    stack << qMakePair( seed.y, first );
+    while (!stack.isEmpty()) {
+        QPair<int,int> current = stack.last();
+        stack.pop_back();
+        const Run& run = m_runs[current.second];
+        spans << Span( current.first, run.begin, run.end );
+
+        for(int dy = -1; dy <= 1; dy += 2) {
+            int y = current.first + dy;
+            if (y < 0 || y >= m_rows)
+                continue;
+            for(int i = m_rowStart[y]; i < m_rowStart[y+1]; ++i) {
+                if (m_runs[i].begin >= run.end)
+                    break;
+                if (m_runs[i].end > run.begin && !taken[i]) {
+                    taken[i] = true;
+                    stack << qMakePair( y, i );
+                }
+            }
+        }
+    }
+
+    return fromSpans( spans, size() );
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+namespace QArtm {
+
+// Binary image stored as sorted runs of set pixels per row.
+//
+// Sparse masks take a fraction of the memory of a CV_8UC1 matrix and the
+// logical operations cost in proportion to the number of runs rather than
+// pixels. Convert to cv::Mat only where OpenCV needs a raster.
+class RunLengthMask {
+public:
+    // set pixels [begin, end) of a row
+    struct Run {
+        Run(int b = 0, int e = 0) : begin(b), end(e) {}
+        int begin, end;
+    };
+    // run in a given row, used to build masks
+    struct Span {
+        Span(int y = 0, int b = 0, int e = 0) : row(y), begin(b), end(e) {}
+        bool operator<(const Span& other) const
+        { return row < other.row || (row == other.row && begin < other.begin); }
+        int row, begin, end;
+    };
+    typedef QVector< Run >::const_iterator RunIterator;
+
+    RunLengthMask();
+    RunLengthMask( int rows, int cols );
+    explicit RunLengthMask( cv::Size size );
+
+    // nonzero pixels of mask, placed at offset into a frame of the given
+    // size (the size of the mask by default)
+    static RunLengthMask fromMat( const cv::Mat& mask,
+                                  cv::Size frame = cv::Size(),
+                                  cv::Point offset = cv::Point() );
+    // spans may overlap and come in any order
+    static RunLengthMask fromSpans( QVector< Span > spans, cv::Size frame );
+
+    int rows() const { return m_rows; }
+    int cols() const { return m_cols; }
+    cv::Size size() const { return cv::Size(m_cols, m_rows); }
+    bool isEmpty() const { return m_runs.isEmpty(); }
+    int runCount() const { return m_runs.size(); }
+    int area() const;
+    cv::Rect boundingRect() const;
+    bool contains( int x, int y ) const;
+    // heap and object memory held by the mask
+    qint64 byteSize() const;
+
+    RunIterator rowBegin( int row ) const { return m_runs.constBegin() + m_rowStart[row]; }
+    RunIterator rowEnd( int row ) const { return m_runs.constBegin() + m_rowStart[row+1]; }
+
+    // rasterize the roi (whole frame by default) with set pixels = value
+    cv::Mat toMat( cv::Rect roi = cv::Rect(), uchar value = 255 ) const;
+    // same, reusing dst if it has the right size and type
+    void toMat( cv::Mat& dst, cv::Rect roi = cv::Rect(), uchar value = 255 ) const;
+
+    RunLengthMask united( const RunLengthMask& other ) const;
+    RunLengthMask subtracted( const RunLengthMask& other ) const;
+    RunLengthMask intersected( const RunLengthMask& other ) const;
+    // the part of the mask inside roi, in roi coordinates
+    RunLengthMask roi( cv::Rect roi ) const;
+    // 4-connected component containing seed, empty if seed isn't set
+    RunLengthMask component( cv::Point seed ) const;
+
+    RunLengthMask& operator|=( const RunLengthMask& other ) { return *this = united(other); }
+    RunLengthMask& operator-=( const RunLengthMask& other ) { return *this = subtracted(other); }
+    RunLengthMask& operator&=( const RunLengthMask& other ) { return *this = intersected(other); }
+
+protected:
+    template<class Op>
+    static RunLengthMask combine( const RunLengthMask& a, const RunLengthMask& b );
+    int findRun( int x, int y ) const;
+
+    int m_rows, m_cols;
+    QVector< int > m_rowStart; // m_rows + 1 offsets into m_runs
+    QVector< Run > m_runs;
+};
+
+}
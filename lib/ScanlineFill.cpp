@@ -0,0 +1,115 @@
+#include "ScanlineFill.hpp"
+
+using namespace QArtm;
+
+namespace {
+
+// visited pixels over a region of interest which grows on demand
+class GrowingMap {
+public:
+    GrowingMap( cv::Rect frame, cv::Point seed, int initialSize )
+        : m_frame(frame)
+    {
+        m_roi = cv::Rect( seed.x - initialSize/2, seed.y - initialSize/2,
+                          initialSize, initialSize ) & m_frame;
+        m_map = cv::Mat( m_roi.size(), CV_8UC1, cv::Scalar(0) );
+    }
+
+    bool visited( int x, int y ) const
+    {
+        return m_roi.contains( cv::Point(x,y) )
+                && m_map.at<uchar>( y - m_roi.y, x - m_roi.x );
+    }
+
+    // mark [x0, x1] of row y
+    void mark( int y, int x0, int x1 )
+    {
+        include( x0, y );
+        include( x1, y );
+        uchar * row = m_map.ptr<uchar>( y - m_roi.y );
+        memset( row + x0 - m_roi.x, 1, x1 - x0 + 1 );
+    }
+
+protected:
+    void include( int x, int y )
+    {
+        if (m_roi.contains( cv::Point(x,y) ))
+            return;
+
+        // at least double the region, centered on the missing point
+        cv::Rect grown = m_roi | cv::Rect( x - m_roi.width/2, y - m_roi.height/2,
+                                           m_roi.width, m_roi.height );
+        grown = (grown | cv::Rect(x, y, 1, 1)) & m_frame;
+
+        cv::Mat map( grown.size(), CV_8UC1, cv::Scalar(0) );
+        cv::Mat old = map( m_roi - grown.tl() );
+        m_map.copyTo( old );
+        m_map = map;
+        m_roi = grown;
+    }
+
+    cv::Rect m_frame, m_roi;
+    cv::Mat m_map;
+};
+
+}
+
+RunLengthMask ScanlineFill::fill( const cv::Mat& image, cv::Point seed, cv::Vec3i tolerance )
+{
+    Q_ASSERT( image.type() == CV_8UC3 );
+    cv::Rect frame( 0, 0, image.cols, image.rows );
+    if (!frame.contains(seed))
+        return RunLengthMask( image.size() );
+
+    cv::Vec3b seedColor = image.at<cv::Vec3b>( seed );
+    int lo[3], hi[3];
+    for(int c = 0; c < 3; ++c) {
+        lo[c] = seedColor[c] - tolerance[c];
+        hi[c] = seedColor[c] + tolerance[c];
+    }
+
+    GrowingMap map( frame, seed, 64 );
+    QVector< RunLengthMask::Span > spans;
+    QVector< cv::Point > stack;
+    stack << seed;
+
+#define INSIDE(p) ( (p)[0] >= lo[0] && (p)[0] <= hi[0] \
+                 && (p)[1] >= lo[1] && (p)[1] <= hi[1] \
+                 && (p)[2] >= lo[2] && (p)[2] <= hi[2] )
+
+    while (!stack.isEmpty()) {
+        cv::Point p = stack.last();
+        stack.pop_back();
+
+        const cv::Vec3b * row = image.ptr<cv::Vec3b>( p.y );
+        if (map.visited( p.x, p.y ) || !INSIDE( row[p.x] ))
+            continue;
+
+        // extend the span left and right
+        int x0 = p.x, x1 = p.x;
+        while (x0 > 0 && INSIDE( row[x0-1] ) && !map.visited( x0-1, p.y ))
+            --x0;
+        while (x1 < image.cols - 1 && INSIDE( row[x1+1] ) && !map.visited( x1+1, p.y ))
+            ++x1;
+        map.mark( p.y, x0, x1 );
+        spans << RunLengthMask::Span( p.y, x0, x1 + 1 );
+
+        // seed every stretch of fillable pixels above and below the span
+        for(int y = p.y - 1; y <= p.y + 1; y += 2) {
+            if (y < 0 || y >= image.rows)
+                continue;
+            const cv::Vec3b * next = image.ptr<cv::Vec3b>( y );
+            bool inStretch = false;
+            for(int x = x0; x <= x1; ++x) {
+                bool fillable = INSIDE( next[x] ) && !map.visited( x, y );
+                if (fillable && !inStretch)
+                    stack << cv::Point( x, y );
+                inStretch = fillable;
+            }
+        }
+    }
+
+#undef INSIDE
+
+    return RunLengthMask::fromSpans( spans, image.size() );
+}
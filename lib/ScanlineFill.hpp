@@ -0,0 +1,19 @@
+#pragma once
+
+#include "RunLengthMask.hpp"
+
+namespace QArtm {
+
+// Flood fill with a fixed range around the seed color.
+//
+// Fills span by span and keeps its visited map over a region around the
+// seed which only grows when the fill reaches its edge, so the cost depends
+// on the size of the filled area and not on the size of the image.
+class ScanlineFill {
+public:
+    // 4-connected region of pixels within tolerance (per channel) of the
+    // seed color, image has to be CV_8UC3
+    static RunLengthMask fill( const cv::Mat& image, cv::Point seed, cv::Vec3i tolerance );
+};
+
+}
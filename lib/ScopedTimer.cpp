@@ -1,16 +1,26 @@
 #include "ScopedTimer.hpp"
+#include "Profiler.hpp"
+#include "TraceRecorder.hpp"
 #include "Pretty.hpp"
+#include "LoggingHub.hpp"
 
 using namespace QArtm;
 
-ScopedTimer::ScopedTimer(const QString& workTitle)
-    : m_workTitle(workTitle)
+ScopedTimer::ScopedTimer(const QString& stage, bool log)
+    : m_stage(stage), m_log(log), m_traceBegin(-1)
 {
-    m_time.start();
+    if (TraceRecorder::enabled())
+        m_traceBegin = TraceRecorder::instance()->now();
+    m_timer.start();
 }
 
 ScopedTimer::~ScopedTimer()
 {
-    qDebug() << qPrintable( QString("Task '%1' finished in %2")
-                            .arg(m_workTitle).arg(Pretty::ms( m_time.elapsed() )) );
+    qint64 ns = m_timer.nsecsElapsed();
+    Profiler::instance()->record( m_stage, ns );
+    if (m_traceBegin >= 0)
+        TraceRecorder::instance()->complete( m_stage, m_traceBegin, ns / 1000 );
+    if (m_log)
+        QARTM_DEBUG << qPrintable( QString("Task '%1' finished in %2")
+                                .arg(m_stage).arg(Pretty::ns( ns )) );
 }
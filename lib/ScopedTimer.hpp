@@ -2,13 +2,18 @@
 
 namespace QArtm {
 
+// Times its own scope as a stage of the Profiler, and may print it too.
+// While the TraceRecorder is on the scope also goes to the trace.
 class ScopedTimer {
 public:
-    ScopedTimer(const QString& workTitle);
+    explicit ScopedTimer(const QString& stage, bool log = false);
     ~ScopedTimer();
+    qint64 elapsedNs() const { return m_timer.nsecsElapsed(); }
 protected:
-    QString m_workTitle;
-    QTime m_time;
+    QString m_stage;
+    bool m_log;
+    QElapsedTimer m_timer;
+    qint64 m_traceBegin; // -1 when not tracing
 };
 
 }
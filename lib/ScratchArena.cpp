@@ -0,0 +1,63 @@
+#include "ScratchArena.hpp"
+
+using namespace QArtm;
+
+ScratchArena::ScratchArena()
+{
+}
+
+cv::Mat ScratchArena::get( const QString& slot, int rows, int cols, int type )
+{
+    QMutexLocker lock(&m_mutex);
+    cv::Mat& buffer = m_slots[slot];
+
+    bool fits = !buffer.empty()
+            && buffer.type() == type
+            && buffer.rows >= rows && buffer.cols >= cols
+            // someone still holds the previous view
+            && buffer.refcount && *buffer.refcount == 1;
+
+    if (fits) {
+        ++m_stats.reuses;
+    } else {
+        // grow only, so alternating sizes settle on one buffer
+        int allocRows = rows, allocCols = cols;
+        if (!buffer.empty() && buffer.type() == type) {
+            allocRows = std::max( rows, buffer.rows );
+            allocCols = std::max( cols, buffer.cols );
+        }
+        buffer = cv::Mat( allocRows, allocCols, type );
+        ++m_stats.allocations;
+        m_stats.bytesAllocated += buffer.total() * buffer.elemSize();
+    }
+
+    return buffer( cv::Rect( 0, 0, cols, rows ) );
+}
+
+cv::Mat ScratchArena::zeros( const QString& slot, int rows, int cols, int type )
+{
+    cv::Mat buffer = get( slot, rows, cols, type );
+    buffer = cv::Scalar::all(0);
+    return buffer;
+}
+
+ScratchArena::Stats ScratchArena::stats() const
+{
+    QMutexLocker lock(&m_mutex);
+    return m_stats;
+}
+
+qint64 ScratchArena::byteSize() const
+{
+    QMutexLocker lock(&m_mutex);
+    qint64 total = 0;
+    foreach(const cv::Mat& buffer, m_slots)
+        total += buffer.total() * buffer.elemSize();
+    return total;
+}
+
+void ScratchArena::clear()
+{
+    QMutexLocker lock(&m_mutex);
+    m_slots.clear();
+}
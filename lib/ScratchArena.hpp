@@ -0,0 +1,42 @@
+#pragma once
+
+namespace QArtm {
+
+// Hands out reusable temporary matrices.
+//
+// Every named slot keeps its buffer between calls. Smaller requests get a
+// view into it, the buffer is only reallocated when it is too small, of a
+// different type or still referenced by an earlier user. The counters show
+// how often buffers were reused versus allocated, so steady state churn is
+// visible.
+class ScratchArena {
+public:
+    struct Stats {
+        Stats() : reuses(0), allocations(0), bytesAllocated(0) {}
+        int reuses, allocations;
+        qint64 bytesAllocated;
+    };
+
+    ScratchArena();
+
+    // buffer of the given geometry, contents undefined
+    cv::Mat get( const QString& slot, int rows, int cols, int type );
+    cv::Mat get( const QString& slot, cv::Size size, int type )
+    { return get( slot, size.height, size.width, type ); }
+    // same, cleared to zeros
+    cv::Mat zeros( const QString& slot, int rows, int cols, int type );
+    cv::Mat zeros( const QString& slot, cv::Size size, int type )
+    { return zeros( slot, size.height, size.width, type ); }
+
+    Stats stats() const;
+    qint64 byteSize() const;
+    // release all buffers
+    void clear();
+
+protected:
+    mutable QMutex m_mutex;
+    QMap< QString, cv::Mat > m_slots;
+    Stats m_stats;
+};
+
+}
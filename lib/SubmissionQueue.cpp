@@ -0,0 +1,98 @@
+#include "SubmissionQueue.hpp"
+#include "Profiler.hpp"
+#include "LoggingHub.hpp"
+
+using namespace QArtm;
+
+SubmissionQueue::SubmissionQueue( QObject * parent )
+    : QObject(parent)
+    , m_network( new QNetworkAccessManager(this) )
+    , m_reply(0)
+    , m_attempt(0)
+    , m_retrying(false)
+    , m_initialBackoff(INITIAL_BACKOFF)
+    , m_maxBackoff(MAX_BACKOFF)
+    , m_backoff(INITIAL_BACKOFF)
+{
+    m_debounce.setSingleShot(true);
+    m_debounce.setInterval(DEBOUNCE);
+    m_retry.setSingleShot(true);
+    m_timeout.setSingleShot(true);
+    m_timeout.setInterval(TIMEOUT);
+
+    connect( &m_debounce, SIGNAL(timeout()), SLOT(send()) );
+    connect( &m_retry, SIGNAL(timeout()), SLOT(send()) );
+    connect( &m_timeout, SIGNAL(timeout()), SLOT(abort()) );
+    connect( m_network, SIGNAL(finished(QNetworkReply*)), SLOT(finished(QNetworkReply*)) );
+}
+
+void SubmissionQueue::submit( const QUrl& url )
+{
+    m_pending = url;
+    m_retrying = false;
+    // new counts don't wait out the backoff of stale ones
+    m_retry.stop();
+    m_backoff = m_initialBackoff;
+    // the in flight request sends these when it's done
+    if (!m_reply)
+        m_debounce.start();
+}
+
+void SubmissionQueue::send()
+{
+    if (m_reply || m_pending.isEmpty())
+        return;
+
+    m_sending = m_pending;
+    m_pending.clear();
+    m_attempt = m_retrying ? m_attempt + 1 : 1;
+    m_retrying = false;
+    QARTM_DEBUG << "Submitting counts to:" << m_sending << (m_attempt > 1 ? QString("attempt %1").arg(m_attempt) : QString());
+
+    m_roundTrip.start();
+    m_reply = m_network->get( QNetworkRequest(m_sending) );
+    m_timeout.start();
+}
+
+void SubmissionQueue::abort()
+{
+    if (m_reply)
+        m_reply->abort();
+}
+
+void SubmissionQueue::finished( QNetworkReply * reply )
+{
+    if (reply != m_reply)
+        return;
+    m_timeout.stop();
+    m_reply = 0;
+    reply->deleteLater();
+
+    qint64 roundTrip = m_roundTrip.nsecsElapsed();
+    bool ok = reply->error() == QNetworkReply::NoError;
+    Profiler::instance()->record( ok ? "submit" : "submit.failed", roundTrip );
+    Profiler::instance()->count( ok ? "submissions.ok" : "submissions.failed" );
+
+    if (ok) {
+        m_lastDelivered = m_sending;
+        m_backoff = m_initialBackoff;
+        emit delivered( m_sending, roundTrip );
+    } else {
+        QString error = reply->error() == QNetworkReply::OperationCanceledError
+                ? QString("timed out") : reply->errorString();
+        qWarning() << "Submission failed:" << error;
+        emit failed( m_sending, error, m_attempt );
+
+        // try again later unless there's something newer to send
+        if (m_pending.isEmpty()) {
+            m_pending = m_sending;
+            m_retrying = true;
+            m_retry.start( m_backoff );
+            m_backoff = std::min( m_backoff * 2, m_maxBackoff );
+            return;
+        }
+    }
+
+    if (!m_pending.isEmpty())
+        m_debounce.start();
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+namespace QArtm {
+
+// Delivers the latest of a stream of GET requests, like counts to a server.
+//
+// Only the newest submission matters: submit() replaces whatever hasn't
+// been sent yet and waits for the submissions to settle before sending.
+// At most one request is in flight. A failed request is retried with an
+// exponential backoff, unless something newer has come in meanwhile, and
+// a request which takes too long is aborted and counts as failed. Round
+// trips go to the Profiler as "submit" and "submit.failed", results as the
+// submissions.ok and submissions.failed counters.
+class SubmissionQueue : public QObject {
+    Q_OBJECT
+public:
+    explicit SubmissionQueue( QObject * parent = 0 );
+
+    void setDebounce( int ms ) { m_debounce.setInterval( ms ); }
+    void setBackoff( int initialMs, int maxMs ) { m_initialBackoff = initialMs; m_maxBackoff = maxMs; }
+    void setTimeout( int ms ) { m_timeout.setInterval( ms ); }
+
+    // nothing waiting, nothing in flight
+    bool isIdle() const { return !m_reply && m_pending.isEmpty(); }
+    QUrl lastDelivered() const { return m_lastDelivered; }
+
+public slots:
+    void submit( const QUrl& url );
+
+signals:
+    void delivered( const QUrl& url, qint64 roundTripNs );
+    void failed( const QUrl& url, const QString& error, int attempt );
+
+protected slots:
+    void send();
+    void finished( QNetworkReply * reply );
+    void abort();
+
+protected:
+    QNetworkAccessManager * m_network;
+    QTimer m_debounce, m_retry, m_timeout;
+    QUrl m_pending, m_sending, m_lastDelivered;
+    QNetworkReply * m_reply;
+    QElapsedTimer m_roundTrip;
+    int m_attempt; // of the request being sent
+    bool m_retrying;
+    int m_initialBackoff, m_maxBackoff, m_backoff;
+
+    static const int DEBOUNCE = 500; // ms
+    static const int INITIAL_BACKOFF = 1000;
+    static const int MAX_BACKOFF = 60000;
+    static const int TIMEOUT = 10000;
+};
+
+}
@@ -0,0 +1,146 @@
+#include "TraceRecorder.hpp"
+
+#include <qt-json/json.h>
+
+using namespace QArtm;
+
+volatile bool TraceRecorder::s_enabled = false;
+TraceRecorder * TraceRecorder::s_instance = 0;
+
+TraceRecorder * TraceRecorder::instance()
+{
+    static QMutex creation;
+    QMutexLocker lock(&creation);
+    if (!s_instance)
+        s_instance = new TraceRecorder;
+    return s_instance;
+}
+
+TraceRecorder::TraceRecorder()
+    : m_pid( QCoreApplication::applicationPid() )
+    , m_nextThreadId(1)
+    , m_first(true)
+{
+    m_epoch.start();
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    stop();
+}
+
+bool TraceRecorder::start( const QString& path )
+{
+    stop();
+
+    QMutexLocker lock(&m_mutex);
+    m_file.setFileName(path);
+    // unbuffered, so what a crashed run traced is in the file
+    if (!m_file.open(QFile::WriteOnly | QFile::Truncate | QIODevice::Unbuffered)) {
+        qWarning() << "Couldn't write the trace to" << path;
+        return false;
+    }
+    m_file.write("[\n");
+    m_first = true;
+    s_enabled = true;
+    qDebug() << "Tracing to" << path;
+    return true;
+}
+
+void TraceRecorder::stop()
+{
+    QMutexLocker lock(&m_mutex);
+    s_enabled = false;
+    if (!m_file.isOpen())
+        return;
+    m_file.write("\n]\n");
+    m_file.close();
+}
+
+void TraceRecorder::flush()
+{
+    QMutexLocker lock(&m_mutex);
+    if (m_file.isOpen())
+        m_file.flush();
+}
+
+void TraceRecorder::complete( const QString& name, qint64 beginUs, qint64 durationUs,
+                              const QVariantMap& args )
+{
+    if (!s_enabled)
+        return;
+
+    QVariantMap event;
+    event["name"] = name;
+    // the first part of a dotted stage name makes the category
+    event["cat"] = name.section('.', 0, 0);
+    event["ph"] = "X";
+    event["ts"] = beginUs;
+    event["dur"] = durationUs;
+    event["pid"] = m_pid;
+    event["tid"] = threadId();
+    if (!args.isEmpty())
+        event["args"] = args;
+    write(event);
+}
+
+void TraceRecorder::instant( const QString& name, const QVariantMap& args )
+{
+    if (!s_enabled)
+        return;
+
+    QVariantMap event;
+    event["name"] = name;
+    event["ph"] = "i";
+    event["s"] = "p";
+    event["ts"] = now();
+    event["pid"] = m_pid;
+    event["tid"] = threadId();
+    if (!args.isEmpty())
+        event["args"] = args;
+    write(event);
+}
+
+int TraceRecorder::threadId()
+{
+    if (m_threadIds.hasLocalData())
+        return *m_threadIds.localData();
+
+    int id;
+    {
+        QMutexLocker lock(&m_mutex);
+        id = m_nextThreadId++;
+    }
+    m_threadIds.setLocalData( new int(id) );
+
+    QThread * thread = QThread::currentThread();
+    QString name = thread->objectName();
+    if (name.isEmpty())
+        name = (QCoreApplication::instance() && thread == QCoreApplication::instance()->thread())
+                ? QString("main")
+                : QString("worker %1").arg(id);
+
+    QVariantMap args;
+    args["name"] = name;
+    QVariantMap metadata;
+    metadata["name"] = "thread_name";
+    metadata["ph"] = "M";
+    metadata["pid"] = m_pid;
+    metadata["tid"] = id;
+    metadata["args"] = args;
+    write(metadata);
+    return id;
+}
+
+void TraceRecorder::write( const QVariantMap& event )
+{
+    QByteArray line = QtJson::serialize(event);
+    QMutexLocker lock(&m_mutex);
+    if (!m_file.isOpen())
+        return;
+    // one write per event, each goes straight to the file
+    if (!m_first)
+        line.prepend(",\n");
+    m_file.write(line);
+    m_first = false;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+namespace QArtm {
+
+// Writes timed scopes as Chrome trace events (chrome://tracing, Perfetto).
+//
+// Events are streamed to the file as a JSON array as they complete, so a
+// trace of a crashed run still opens. Every thread gets a small id and a
+// thread_name record the first time it shows up. Recording is off until
+// start() and costs a single check while off.
+class TraceRecorder {
+public:
+    static TraceRecorder * instance();
+    static bool enabled() { return s_enabled; }
+
+    bool start( const QString& path );
+    void stop();
+    void flush();
+
+    // microseconds since the recorder was created
+    qint64 now() const { return m_epoch.nsecsElapsed() / 1000; }
+
+    // a finished scope of the current thread
+    void complete( const QString& name, qint64 beginUs, qint64 durationUs,
+                   const QVariantMap& args = QVariantMap() );
+    // a moment of the current thread, like the snapshot being loaded
+    void instant( const QString& name, const QVariantMap& args = QVariantMap() );
+
+protected:
+    TraceRecorder();
+    virtual ~TraceRecorder();
+
+    // id of the current thread, announcing it first if it is new
+    int threadId();
+    void write( const QVariantMap& event );
+
+    QMutex m_mutex;
+    QFile m_file;
+    QElapsedTimer m_epoch;
+    qint64 m_pid;
+    int m_nextThreadId;
+    bool m_first;
+    QThreadStorage< int * > m_threadIds;
+
+    static volatile bool s_enabled;
+    static TraceRecorder * s_instance;
+};
+
+}
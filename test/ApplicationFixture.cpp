@@ -0,0 +1,33 @@
+#include "ApplicationFixture.hpp"
+#include "ImageWriter.hpp"
+
+ApplicationFixture::ApplicationFixture( const char * name, Kind kind, bool usesImageWriter )
+    : m_name(name)
+    , m_kind(kind)
+    , m_usesImageWriter(usesImageWriter)
+    , m_argc(1)
+    , m_app(0)
+{
+    m_argv[0] = m_name.data();
+    m_argv[1] = 0;
+}
+
+bool ApplicationFixture::setUpWorld()
+{
+    if (m_kind == GUI)
+        m_app = new QApplication( m_argc, m_argv );
+    else
+        m_app = new QCoreApplication( m_argc, m_argv );
+    m_app->setOrganizationDomain("thepeoplespeak.com");
+    m_app->setApplicationName("Vote Counter Tests");
+    return true;
+}
+
+bool ApplicationFixture::tearDownWorld()
+{
+    if (m_usesImageWriter)
+        QArtm::ImageWriter::instance()->stop();
+    delete m_app;
+    m_app = 0;
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cxxtest/GlobalFixture.h>
+
+// The application the tests of a suite run in, for the event loop, the
+// settings and, with GUI, the scene graph. A suite declares one:
+//
+//   static ApplicationFixture applicationFixture( "test_name", ApplicationFixture::CORE );
+//
+// A suite using the image writer has it stopped before the application
+// goes.
+class ApplicationFixture : public CxxTest::GlobalFixture {
+public:
+    enum Kind { CORE, GUI };
+
+    ApplicationFixture( const char * name, Kind kind, bool usesImageWriter = false );
+
+    bool setUpWorld();
+    bool tearDownWorld();
+
+protected:
+    QByteArray m_name;
+    Kind m_kind;
+    bool m_usesImageWriter;
+    // the application keeps referring to these
+    int m_argc;
+    char * m_argv[2];
+    QCoreApplication * m_app;
+};
@@ -0,0 +1,101 @@
+#include "SyntheticAudience.hpp"
+
+namespace {
+
+const cv::Vec3b CARD_COLORS[] = {
+    cv::Vec3b(  70, 190,  90 ), // green
+    cv::Vec3b( 235, 100, 180 ), // pink
+    cv::Vec3b( 240, 225,  60 )  // yellow
+};
+
+cv::Scalar scaled( const cv::Vec3b& color, double light )
+{
+    return cv::Scalar( color[0] * light, color[1] * light, color[2] * light );
+}
+
+}
+
+SyntheticAudience::SyntheticAudience( const Parameters& parameters )
+    : m_parameters(parameters)
+{
+    int width = cvRound( std::sqrt( parameters.megapixels * 1e6 * 4.0 / 3.0 ) );
+    int height = cvRound( width * 3.0 / 4.0 );
+    cv::RNG rng( parameters.seed );
+
+    // the hall, darker towards the back
+    cv::Mat image( height, width, CV_8UC3 );
+    for(int y = 0; y < height; ++y) {
+        double light = 90 * (1.0 - parameters.lightingGradient * (1.0 - (double)y / height));
+        image.row(y) = cv::Scalar( light, light * 0.85, light * 0.75 );
+    }
+
+    int seat = std::max( 16, width / 36 );
+    for(int cy = seat / 2; cy + seat / 2 < height; cy += seat) {
+        double rowLight = 1.0 - parameters.lightingGradient * 0.5 * (1.0 - (double)cy / height);
+        for(int cx = seat / 2; cx + seat / 2 < width; cx += seat) {
+            cv::Point head( cx + rng.uniform(-seat/8, seat/8 + 1), cy + seat / 6 );
+            int skin = rng.uniform( 120, 220 );
+            cv::circle( image, head, seat / 5,
+                        cv::Scalar( skin, skin * 0.75, skin * 0.6 ) * rowLight, -1 );
+
+            if (rng.uniform(0.0, 1.0) >= parameters.cardFraction)
+                continue;
+
+            Card card;
+            card.color = rng.uniform( 0, 3 );
+            card.rect = cv::Rect( cx - seat / 3, cy - seat / 3, seat / 2, seat / 3 );
+            double light = rowLight * (1.0 + parameters.lightingJitter * rng.uniform(-1.0, 1.0));
+            cv::rectangle( image, card.rect, scaled( CARD_COLORS[card.color], light ), -1 );
+
+            // a neighbour's head over the right corner, never more than a
+            // third of the card, so it stays in one piece
+            if (rng.uniform(0.0, 1.0) < parameters.occlusion) {
+                int radius = card.rect.height / 2;
+                cv::Point corner( card.rect.br().x, card.rect.y );
+                int neighbour = rng.uniform( 120, 220 );
+                cv::circle( image, corner, radius,
+                            cv::Scalar( neighbour, neighbour * 0.75, neighbour * 0.6 ) * rowLight, -1 );
+            }
+            m_cards << card;
+        }
+    }
+
+    // sensor noise
+    cv::Mat noise( height, width, CV_16SC3 ), noisy;
+    rng.fill( noise, cv::RNG::NORMAL, cv::Scalar::all(0), cv::Scalar::all(parameters.noise) );
+    image.convertTo( noisy, CV_16SC3 );
+    noisy += noise;
+    noisy.convertTo( m_image, CV_8UC3 );
+}
+
+QStringList SyntheticAudience::colorNames()
+{
+    return QStringList() << "green" << "pink" << "yellow";
+}
+
+int SyntheticAudience::count( const QString& color ) const
+{
+    int index = colorNames().indexOf(color);
+    int total = 0;
+    foreach(const Card& card, m_cards)
+        if (card.color == index)
+            ++total;
+    return total;
+}
+
+cv::Point SyntheticAudience::center( const Card& card )
+{
+    // left of the middle, away from the occluded corner
+    return cv::Point( card.rect.x + card.rect.width / 3,
+                      card.rect.y + card.rect.height / 2 );
+}
+
+bool SyntheticAudience::save( const QString& path ) const
+{
+    cv::Mat bgr;
+    cv::cvtColor( m_image, bgr, CV_RGB2BGR );
+    std::vector< int > quality;
+    quality.push_back( CV_IMWRITE_JPEG_QUALITY );
+    quality.push_back( 95 );
+    return cv::imwrite( path.toStdString(), bgr, quality );
+}
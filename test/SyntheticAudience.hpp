@@ -0,0 +1,47 @@
+#pragma once
+
+// Audience-like scenes with a known number of cards of each color.
+//
+// Rows of seats in a hall lit from the front, each with a head and some of
+// them holding up a card. Everything comes from the seed, so the same
+// parameters always render the same picture and the same counts.
+class SyntheticAudience {
+public:
+    struct Parameters {
+        Parameters()
+            : megapixels(1.0), seed(1), cardFraction(0.6),
+              noise(6.0), lightingGradient(0.3), lightingJitter(0.1),
+              occlusion(0.0) {}
+        double megapixels;
+        quint64 seed;
+        double cardFraction;     // seats holding up a card
+        double noise;            // sigma of the sensor noise, in 8 bit units
+        double lightingGradient; // how much darker the back rows are, 0..1
+        double lightingJitter;   // brightness spread between cards, 0..1
+        double occlusion;        // cards with a corner hidden by a head
+    };
+
+    struct Card {
+        cv::Rect rect;
+        int color; // index into the colors
+    };
+
+    explicit SyntheticAudience( const Parameters& parameters = Parameters() );
+
+    // card colors, the names SnapshotModel knows them by by default
+    static QStringList colorNames();
+
+    const cv::Mat& image() const { return m_image; } // RGB
+    const QList< Card >& cards() const { return m_cards; }
+    int count( const QString& color ) const;
+    // a point inside the visible part of the card
+    static cv::Point center( const Card& card );
+
+    // as a jpeg, like the camera would
+    bool save( const QString& path ) const;
+
+protected:
+    Parameters m_parameters;
+    cv::Mat m_image;
+    QList< Card > m_cards;
+};
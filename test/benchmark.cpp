@@ -0,0 +1,240 @@
+// Benchmarks of the vision pipeline on synthetic snapshots.
+//
+//   benchmark [--mp 1,4,12,24] [--threads 1,4] [--iterations 3]
+//             [--baseline file.json] [--save-baseline file.json]
+//             [--tolerance 0.1] [--profile file.json] [--coarse]
+//
+// Every stage is timed on its own at every resolution and thread count and
+// reported in megapixels of the frame per second. With --baseline the
+// throughput is compared against a stored run and the exit code is 1 when
+// a stage got slower than the tolerance allows. --coarse classifies
+// coarse to fine.
+
+#include "SnapshotModel.hpp"
+#include "ImageWriter.hpp"
+#include "Profiler.hpp"
+#include "SyntheticAudience.hpp"
+
+#include <qt-json/json.h>
+
+#include <iostream>
+
+namespace {
+
+struct Timing {
+    QList< double > seconds;
+
+    double mean() const {
+        double sum = 0;
+        foreach(double s, seconds) sum += s;
+        return seconds.isEmpty() ? 0 : sum / seconds.size();
+    }
+    double stddev() const {
+        if (seconds.size() < 2) return 0;
+        double m = mean(), sum = 0;
+        foreach(double s, seconds) sum += (s - m) * (s - m);
+        return std::sqrt( sum / (seconds.size() - 1) );
+    }
+};
+
+class Benchmark {
+public:
+    Benchmark() : m_iterations(3), m_coarse(false), m_tolerance(0.1) {}
+
+    int m_iterations;
+    bool m_coarse;
+    double m_tolerance;
+    QVariantMap m_results, m_baseline;
+    QStringList m_regressions;
+
+    void run( double megapixels, int threads, const QDir& dir )
+    {
+        QThreadPool::globalInstance()->setMaxThreadCount( threads );
+        cv::setNumThreads( threads );
+
+        SyntheticAudience::Parameters scene;
+        scene.megapixels = megapixels;
+        SyntheticAudience audience( scene );
+        const cv::Mat& image = audience.image();
+        double mp = image.total() / 1e6;
+
+        // a fresh directory, so no palette from an earlier run is picked up
+        QString sub = QString("%1mp-%2t").arg(megapixels).arg(threads);
+        dir.mkpath(sub);
+        QDir runDir( dir.filePath(sub) );
+        foreach(QString file, runDir.entryList( QDir::Files ))
+            runDir.remove(file);
+        QString path = runDir.filePath("snapshot.jpg");
+        audience.save( path );
+
+        QVariantMap parameters;
+        parameters["sizeLimit"] = std::max( image.cols, image.rows );
+        parameters["pickFuzz"] = 10;
+        parameters["colorDiffThreshold"] = 12;
+        parameters["sizeFilter"] = 5;
+        parameters["openingSize"] = 3;
+        parameters["coarseToFine"] = m_coarse;
+        SnapshotModel model( path, 0, parameters );
+
+        // train on the first cards of every color
+        QStringList colors = SnapshotModel::colorNames();
+        Timing pick;
+        model.setMode( SnapshotModel::TRAIN );
+        for(int color = 0; color < colors.size(); ++color) {
+            model.setTrainMode( colors[color] );
+            int picked = 0;
+            foreach(const SyntheticAudience::Card& card, audience.cards()) {
+                if (card.color != color || picked++ >= 3)
+                    continue;
+                cv::Point center = SyntheticAudience::center( card );
+                QElapsedTimer timer;
+                timer.start();
+                model.floodPickContour( center.x, center.y, 10, "train.contours." + colors[color] );
+                pick.seconds << timer.nsecsElapsed() / 1e9;
+            }
+        }
+        report( "floodPickContour", megapixels, threads, mp, pick );
+
+        Timing learn, classify, threshold, count;
+        for(int i = 0; i < m_iterations; ++i) {
+            QElapsedTimer timer;
+            timer.start();
+            model.on_learn_clicked();
+            learn.seconds << timer.nsecsElapsed() / 1e9;
+        }
+        report( "on_learn_clicked", megapixels, threads, mp, learn );
+
+        model.setMode( SnapshotModel::COUNT );
+        for(int i = 0; i < m_iterations; ++i) {
+            QElapsedTimer timer;
+            timer.start();
+            model.classifyPixels();
+            classify.seconds << timer.nsecsElapsed() / 1e9;
+
+            timer.start();
+            model.computeColorDiff();
+            threshold.seconds << timer.nsecsElapsed() / 1e9;
+
+            timer.start();
+            model.countCards();
+            count.seconds << timer.nsecsElapsed() / 1e9;
+        }
+        report( "classifyPixels", megapixels, threads, mp, classify );
+        report( "computeColorDiff", megapixels, threads, mp, threshold );
+        report( "countCards", megapixels, threads, mp, count );
+
+        int counted = 0;
+        foreach(QString color, colors)
+            counted += model.cardCount(color);
+        std::cout << "  counted " << counted << " of " << audience.cards().size() << " cards\n";
+    }
+
+    void report( const QString& stage, double megapixels, int threads, double mp, const Timing& timing )
+    {
+        double mean = timing.mean();
+        double throughput = mean > 0 ? mp / mean : 0;
+        QString key = QString("%1@%2MP/%3t").arg(stage).arg(megapixels).arg(threads);
+        m_results[key] = throughput;
+
+        QString line = QString("%1 %2 %3 %4 %5 %6")
+                .arg( stage, -18 )
+                .arg( megapixels, 4 )
+                .arg( threads, 7 )
+                .arg( mean * 1000, 10, 'f', 1 )
+                .arg( timing.stddev() * 1000, 9, 'f', 1 )
+                .arg( throughput, 9, 'f', 2 );
+
+        if (m_baseline.contains(key)) {
+            double before = m_baseline[key].toDouble();
+            double change = before > 0 ? throughput / before - 1.0 : 0;
+            line += QString(" %1%").arg( change * 100, 7, 'f', 1 );
+            if (change < -m_tolerance) {
+                line += " REGRESSION";
+                m_regressions << key;
+            }
+        }
+        std::cout << qPrintable(line) << "\n";
+    }
+};
+
+QList< double > numbers( const QString& list )
+{
+    QList< double > result;
+    foreach(QString item, list.split(',', QString::SkipEmptyParts))
+        result << item.toDouble();
+    return result;
+}
+
+}
+
+int main( int argc, char * argv[] )
+{
+    QApplication app(argc, argv);
+    // keep away from the settings of the real app
+    app.setOrganizationDomain("thepeoplespeak.com");
+    app.setApplicationName("Vote Counter Benchmark");
+
+    QList< double > megapixels = QList< double >() << 1 << 4 << 12 << 24;
+    QList< double > threads = QList< double >() << 1 << QThread::idealThreadCount();
+    QString baselineFile, saveBaselineFile, profileFile;
+    Benchmark benchmark;
+
+    QStringList args = app.arguments();
+    for(int i = 1; i < args.size(); ++i) {
+        QString arg = args[i];
+        QString value = (i + 1 < args.size()) ? args[i+1] : QString();
+        if (arg == "--mp") { megapixels = numbers(value); ++i; }
+        else if (arg == "--threads") { threads = numbers(value); ++i; }
+        else if (arg == "--iterations") { benchmark.m_iterations = std::max(1, value.toInt()); ++i; }
+        else if (arg == "--baseline") { baselineFile = value; ++i; }
+        else if (arg == "--save-baseline") { saveBaselineFile = value; ++i; }
+        else if (arg == "--tolerance") { benchmark.m_tolerance = value.toDouble(); ++i; }
+        else if (arg == "--profile") { profileFile = value; ++i; }
+        else if (arg == "--coarse") { benchmark.m_coarse = true; }
+        else {
+            std::cerr << "unknown argument " << qPrintable(arg) << "\n";
+            return 2;
+        }
+    }
+
+    if (!baselineFile.isEmpty()) {
+        QFile file(baselineFile);
+        if (!file.open(QFile::ReadOnly)) {
+            std::cerr << "can't read the baseline " << qPrintable(baselineFile) << "\n";
+            return 2;
+        }
+        bool ok = false;
+        benchmark.m_baseline = QtJson::parse( QString::fromUtf8(file.readAll()), ok ).toMap();
+        if (!ok) {
+            std::cerr << "can't parse the baseline " << qPrintable(baselineFile) << "\n";
+            return 2;
+        }
+    }
+
+    QDir dir( QDir::temp().filePath("votecounter-benchmark") );
+    dir.mkpath(".");
+
+    std::cout << "stage                MP threads    mean ms     +- ms      MP/s"
+              << (benchmark.m_baseline.isEmpty() ? "" : "  change") << "\n";
+    foreach(double mp, megapixels)
+        foreach(double n, threads)
+            benchmark.run( mp, (int)n, dir );
+
+    QArtm::ImageWriter::instance()->stop();
+
+    if (!saveBaselineFile.isEmpty()) {
+        QFile file(saveBaselineFile);
+        if (file.open(QFile::WriteOnly | QFile::Truncate))
+            file.write( QtJson::serialize( benchmark.m_results ) );
+        else
+            std::cerr << "can't write the baseline " << qPrintable(saveBaselineFile) << "\n";
+    }
+    if (!profileFile.isEmpty())
+        QArtm::Profiler::instance()->dump(profileFile);
+
+    if (!benchmark.m_regressions.isEmpty()) {
+        std::cout << benchmark.m_regressions.size() << " stages regressed\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,279 @@
+// Replays a recorded session against headless snapshot models.
+//
+//   replay session.jsonl [--snaps dir] [--repeat 1] [--json results.json]
+//                        [--profile file.json]
+//
+// The session comes from the app with `sessionFile` set. Every action is
+// applied as fast as it goes, the same slots the UI would call, and timed
+// from the call until the model is done with it, counting included. The
+// latencies are reported per kind of action (point.left, value.sizeFilter,
+// click.count ...) as percentiles. --snaps looks the snapshots up in
+// another directory, by file name. Replaying edits the training data next
+// to the snapshots just like the operator did, so run it on a copy.
+
+#include "SnapshotModel.hpp"
+#include "ImageWriter.hpp"
+#include "InteractionRecorder.hpp"
+#include "Profiler.hpp"
+
+#include <qt-json/json.h>
+
+#include <iostream>
+
+namespace {
+
+// waits out the background part of counting
+class CountWaiter : public QObject {
+    Q_OBJECT
+public:
+    CountWaiter() : m_counting(false) {}
+
+    void watch( SnapshotModel * model )
+    {
+        connect( model, SIGNAL(willCount()), SLOT(willCount()) );
+        connect( model, SIGNAL(doneCounting()), SLOT(doneCounting()) );
+    }
+    void wait()
+    {
+        if (m_counting)
+            m_loop.exec();
+    }
+
+public slots:
+    void willCount() { m_counting = true; }
+    void doneCounting()
+    {
+        m_counting = false;
+        m_loop.quit();
+    }
+
+protected:
+    bool m_counting;
+    QEventLoop m_loop;
+};
+
+class Replay {
+public:
+    Replay() : m_model(0) {}
+    ~Replay() { delete m_model; }
+
+    QString m_snapsDir;
+    QMap< QString, QList< double > > m_latencies; // ms
+
+    bool run( const QList< QVariantMap >& events )
+    {
+        foreach(const QVariantMap& event, events) {
+            QString action = apply( event );
+            if (action.isEmpty())
+                continue;
+            if (action == "error")
+                return false;
+            qint64 ns = m_timer.nsecsElapsed();
+            m_latencies[action] << ns / 1e6;
+            QArtm::Profiler::instance()->record( "replay." + action, ns );
+        }
+        return true;
+    }
+
+    void report() const
+    {
+        std::cout << "action                        count    p50 ms    p95 ms    p99 ms    max ms\n";
+        foreach(QString action, m_latencies.keys()) {
+            QList< double > ms = m_latencies[action];
+            qSort(ms);
+            std::cout << qPrintable( QString("%1 %2 %3 %4 %5 %6")
+                                     .arg( action, -28 )
+                                     .arg( ms.size(), 6 )
+                                     .arg( percentile(ms, 0.50), 9, 'f', 1 )
+                                     .arg( percentile(ms, 0.95), 9, 'f', 1 )
+                                     .arg( percentile(ms, 0.99), 9, 'f', 1 )
+                                     .arg( ms.last(), 9, 'f', 1 ) ) << "\n";
+        }
+    }
+
+    QVariantMap results() const
+    {
+        QVariantMap results;
+        foreach(QString action, m_latencies.keys()) {
+            QList< double > ms = m_latencies[action];
+            qSort(ms);
+            QVariantMap result;
+            result["count"] = ms.size();
+            result["p50_ms"] = percentile(ms, 0.50);
+            result["p95_ms"] = percentile(ms, 0.95);
+            result["p99_ms"] = percentile(ms, 0.99);
+            result["max_ms"] = ms.last();
+            results[action] = result;
+        }
+        return results;
+    }
+
+protected:
+    SnapshotModel * m_model;
+    CountWaiter m_counting;
+    QElapsedTimer m_timer;
+
+    static double percentile( const QList< double >& sorted, double p )
+    {
+        return sorted[ std::min( sorted.size() - 1, (int)(p * sorted.size()) ) ];
+    }
+
+    static QString buttonName( const QVariantMap& event )
+    {
+        return event["button"].toInt() == Qt::LeftButton ? "left" : "right";
+    }
+
+    // the kind of action applied, nothing if the event wasn't one
+    QString apply( const QVariantMap& event )
+    {
+        QString type = event["type"].toString();
+        QString name = event["name"].toString();
+
+        if (type == "snapshot") {
+            QString path = event["path"].toString();
+            if (!m_snapsDir.isEmpty())
+                path = QDir(m_snapsDir).filePath( QFileInfo(path).fileName() );
+            if (!QFile::exists(path)) {
+                std::cerr << "no snapshot " << qPrintable(path) << "\n";
+                return "error";
+            }
+            QVariantMap parameters;
+            foreach(QString parameter, QStringList() << "sizeLimit" << "pickFuzz" << "colorDiffThreshold" << "sizeFilter")
+                parameters[parameter] = event[parameter];
+            parameters["coarseToFine"] = event.value("coarseToFine", false);
+            parameters["openingSize"] = event.value("openingSize", 3);
+
+            m_timer.start();
+            delete m_model;
+            m_model = new SnapshotModel( path, 0, parameters );
+            m_counting.watch( m_model );
+            return "snapshot";
+        }
+
+        if (!m_model) {
+            std::cerr << "a " << qPrintable(type) << " before any snapshot\n";
+            return "error";
+        }
+
+        m_timer.start();
+        if (type == "mode") {
+            if (event["index"].toInt() == 0)
+                m_model->setTrainMode( event["color"].toString() );
+            else
+                m_model->setMode( SnapshotModel::COUNT );
+            return "mode";
+        }
+        if (type == "point") {
+            m_model->on_mouseLogic_pointClicked(
+                        QPointF( event["x"].toDouble(), event["y"].toDouble() ),
+                        (Qt::MouseButton)event["button"].toInt(),
+                        (Qt::KeyboardModifiers)event["mods"].toInt() );
+            return "point." + buttonName(event);
+        }
+        if (type == "rect") {
+            m_model->on_mouseLogic_rectSelected(
+                        QRectF( event["x"].toDouble(), event["y"].toDouble(),
+                                event["width"].toDouble(), event["height"].toDouble() ),
+                        (Qt::MouseButton)event["button"].toInt(),
+                        (Qt::KeyboardModifiers)event["mods"].toInt() );
+            return "rect." + buttonName(event);
+        }
+        if (type == "value") {
+            m_model->setParameter( name, event["value"] );
+            if (name == "colorDiffThreshold")
+                m_model->on_colorDiffThreshold_valueChanged();
+            else if (name == "sizeFilter")
+                m_model->on_sizeFilter_valueChanged();
+            else
+                return QString(); // read when used
+            return "value." + name;
+        }
+        if (type == "press" || type == "release") {
+            bool press = type == "press";
+            if (name == "colorDiffThreshold") {
+                if (press) m_model->on_colorDiffThreshold_sliderPressed();
+                else m_model->on_colorDiffThreshold_sliderReleased();
+            } else if (name == "colorDiffOn") {
+                if (press) m_model->on_colorDiffOn_pressed();
+                else m_model->on_colorDiffOn_released();
+            } else
+                return QString(); // the click is what counts
+            return type + "." + name;
+        }
+        if (type == "click") {
+            if (name == "learn")
+                m_model->on_learn_clicked();
+            else if (name == "count") {
+                m_model->on_count_clicked();
+                m_counting.wait();
+            } else if (name == "resetLayer")
+                m_model->on_resetLayer_clicked();
+            else if (name.endsWith("TrainMode"))
+                m_model->setTrainMode( name.left( name.size() - QString("TrainMode").size() ) );
+            else
+                return QString();
+            return "click." + name;
+        }
+        return QString();
+    }
+};
+
+}
+
+int main( int argc, char * argv[] )
+{
+    QApplication app(argc, argv);
+    // keep away from the settings of the real app
+    app.setOrganizationDomain("thepeoplespeak.com");
+    app.setApplicationName("Vote Counter Replay");
+
+    QString sessionFile, jsonFile, profileFile;
+    int repeat = 1;
+    Replay replay;
+
+    QStringList args = app.arguments();
+    for(int i = 1; i < args.size(); ++i) {
+        QString arg = args[i];
+        QString value = (i + 1 < args.size()) ? args[i+1] : QString();
+        if (arg == "--snaps") { replay.m_snapsDir = value; ++i; }
+        else if (arg == "--repeat") { repeat = std::max(1, value.toInt()); ++i; }
+        else if (arg == "--json") { jsonFile = value; ++i; }
+        else if (arg == "--profile") { profileFile = value; ++i; }
+        else if (sessionFile.isEmpty() && !arg.startsWith("--")) sessionFile = arg;
+        else {
+            std::cerr << "unknown argument " << qPrintable(arg) << "\n";
+            return 2;
+        }
+    }
+    if (sessionFile.isEmpty()) {
+        std::cerr << "usage: replay session.jsonl [--snaps dir] [--repeat n] [--json file] [--profile file]\n";
+        return 2;
+    }
+
+    QList< QVariantMap > events = QArtm::InteractionRecorder::load( sessionFile );
+    if (events.isEmpty()) {
+        std::cerr << "nothing to replay in " << qPrintable(sessionFile) << "\n";
+        return 2;
+    }
+
+    bool ok = true;
+    for(int i = 0; i < repeat && ok; ++i)
+        ok = replay.run( events );
+
+    QArtm::ImageWriter::instance()->stop();
+    replay.report();
+
+    if (!jsonFile.isEmpty()) {
+        QFile file(jsonFile);
+        if (file.open(QFile::WriteOnly | QFile::Truncate))
+            file.write( QtJson::serialize( replay.results() ) );
+        else
+            std::cerr << "can't write the results " << qPrintable(jsonFile) << "\n";
+    }
+    if (!profileFile.isEmpty())
+        QArtm::Profiler::instance()->dump(profileFile);
+
+    return ok ? 0 : 1;
+}
+
+#include "replay.moc"
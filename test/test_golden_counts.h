@@ -0,0 +1,219 @@
+#include <cxxtest/TestSuite.h>
+
+#include "ApplicationFixture.hpp"
+
+#include "SnapshotModel.hpp"
+#include "SyntheticAudience.hpp"
+
+// The scene graph needs a GUI application, and the models write masks
+static ApplicationFixture applicationFixture( "test_golden_counts", ApplicationFixture::GUI, true );
+
+// Counts the whole pipeline gives on synthetic audiences, which have to be
+// exactly the cards rendered and come within a time budget. Set
+// VOTECOUNTER_TIME_BUDGET (seconds) for slower builds.
+class GoldenCountsTest : public CxxTest::TestSuite {
+public:
+    void testCleanScene()
+    {
+        SyntheticAudience::Parameters scene;
+        scene.megapixels = 2;
+        scene.seed = 7;
+        checkCounts( "clean", scene, 10.0 );
+    }
+
+    void testNoisyOccludedScene()
+    {
+        SyntheticAudience::Parameters scene;
+        scene.megapixels = 4;
+        scene.seed = 11;
+        scene.noise = 10;
+        scene.lightingGradient = 0.4;
+        scene.lightingJitter = 0.15;
+        scene.occlusion = 0.3;
+        checkCounts( "noisy", scene, 20.0 );
+    }
+
+    // cards of the rows below the audience area don't count
+    void testAudienceArea()
+    {
+        SyntheticAudience::Parameters scene;
+        scene.megapixels = 2;
+        scene.seed = 7;
+        SyntheticAudience audience( scene );
+
+        // the top of a card row in the middle, the row above ends well before
+        QList< int > tops;
+        foreach(const SyntheticAudience::Card& card, audience.cards())
+            if (!tops.contains(card.rect.y))
+                tops << card.rect.y;
+        qSort(tops);
+        double bottom = (tops[ tops.size() / 2 ] - 1.0) / audience.image().rows;
+
+        QPolygonF area;
+        area << QPointF(0, 0) << QPointF(1, 0) << QPointF(1, bottom) << QPointF(0, bottom);
+        checkCounts( "audience", scene, 10.0, area );
+    }
+
+    // the tiles filled from the smaller frame come out the same
+    void testCoarseToFine()
+    {
+        SyntheticAudience::Parameters scene;
+        scene.megapixels = 4;
+        scene.seed = 11;
+        scene.noise = 10;
+        scene.lightingGradient = 0.4;
+        checkCounts( "coarse", scene, 20.0, QPolygonF(), true );
+    }
+
+    // a snapshot classified partly from an earlier one comes out the same
+    // as one classified from scratch
+    void testIncremental()
+    {
+        SyntheticAudience::Parameters scene;
+        scene.megapixels = 2;
+        scene.seed = 7;
+        SyntheticAudience audience( scene );
+        QDir dir = emptyDir("incremental");
+        QString first = dir.filePath("first.jpg"), second = dir.filePath("second.jpg");
+        TS_ASSERT( audience.save(first) );
+
+        // a few cards change places, and a card as small as the size filter
+        // lets through comes up over a tile corner away from the others
+        cv::Mat image = audience.image().clone();
+        QList< SyntheticAudience::Card > cards = audience.cards();
+        for(int i = 0; i < 3; ++i) {
+            cv::Rect from = cards[ i * cards.size() / 3 ].rect, to = cards[ i * cards.size() / 3 + 1 ].rect;
+            cv::Size size( std::min( from.width, to.width ), std::min( from.height, to.height ) );
+            image( cv::Rect( from.tl(), size ) ).copyTo( image( cv::Rect( to.tl(), size ) ) );
+        }
+        cv::Point center = SyntheticAudience::center( cards.first() );
+        cv::Rect small( center.x - 3, center.y - 3, 7, 7 );
+        bool placed = false;
+        for(int y = 64; y < image.rows - 64 && !placed; y += 64)
+            for(int x = 64; x < image.cols - 64 && !placed; x += 64) {
+                cv::Rect corner( x - 3, y - 3, 7, 7 ), around( x - 12, y - 12, 24, 24 );
+                bool clear = true;
+                foreach(const SyntheticAudience::Card& card, cards)
+                    clear = clear && (card.rect & around).area() == 0;
+                if (clear) {
+                    image( small ).copyTo( image( corner ) );
+                    placed = true;
+                }
+            }
+        TS_ASSERT( placed );
+        cv::Mat bgr;
+        cv::cvtColor( image, bgr, CV_RGB2BGR );
+        TS_ASSERT( cv::imwrite( second.toStdString(), bgr ) );
+
+        QVariantMap parameters = parametersFor( audience );
+        {
+            SnapshotModel trainer( first, 0, parameters );
+            train( trainer, audience );
+        }
+        // all from the palette saved with the directory
+        SnapshotModel previous( first, 0, parameters );
+        count( previous );
+
+        SnapshotModel incremental( second, 0, parameters );
+        incremental.reuseClassification( previous );
+        count( incremental );
+
+        SnapshotModel fresh( second, 0, parameters );
+        count( fresh );
+
+        foreach(QString color, SyntheticAudience::colorNames())
+            TSM_ASSERT_EQUALS( qPrintable(color), incremental.cardCount(color), fresh.cardCount(color) );
+    }
+
+protected:
+    static QDir emptyDir( const QString& name )
+    {
+        QDir dir( QDir::temp().filePath("votecounter-golden") );
+        dir.mkpath(name);
+        dir.cd(name);
+        foreach(QString file, dir.entryList( QDir::Files ))
+            dir.remove(file);
+        return dir;
+    }
+
+    static QVariantMap parametersFor( const SyntheticAudience& audience )
+    {
+        QVariantMap parameters;
+        parameters["sizeLimit"] = std::max( audience.image().cols, audience.image().rows );
+        parameters["pickFuzz"] = 10;
+        parameters["colorDiffThreshold"] = 15;
+        parameters["sizeFilter"] = 5;
+        parameters["openingSize"] = 3;
+        return parameters;
+    }
+
+    // on a spread of cards of every color, like the operator would
+    void train( SnapshotModel& model, const SyntheticAudience& audience )
+    {
+        QStringList colors = SyntheticAudience::colorNames();
+        model.setMode( SnapshotModel::TRAIN );
+        for(int color = 0; color < colors.size(); ++color) {
+            QList< SyntheticAudience::Card > cards;
+            foreach(const SyntheticAudience::Card& card, audience.cards())
+                if (card.color == color)
+                    cards << card;
+            TS_ASSERT( cards.size() >= 8 );
+            for(int i = 0; i < 8; ++i) {
+                cv::Point pick = SyntheticAudience::center( cards[ i * cards.size() / 8 ] );
+                model.floodPickContour( pick.x, pick.y, 10, "train.contours." + colors[color] );
+            }
+        }
+        model.on_learn_clicked();
+    }
+
+    void count( SnapshotModel& model )
+    {
+        model.setMode( SnapshotModel::COUNT );
+        model.classifyPixels();
+        model.computeColorDiff();
+        model.countCards();
+    }
+
+    void checkCounts( const QString& name, const SyntheticAudience::Parameters& scene, double budget,
+                      const QPolygonF& area = QPolygonF(), bool coarse = false )
+    {
+        SyntheticAudience audience( scene );
+
+        QString path = emptyDir(name).filePath("snapshot.jpg");
+        TS_ASSERT( audience.save(path) );
+
+        QVariantMap parameters = parametersFor( audience );
+        parameters["coarseToFine"] = coarse;
+        SnapshotModel model( path, 0, parameters );
+        model.setAudience( area );
+
+        QElapsedTimer timer;
+        timer.start();
+
+        train( model, audience );
+        count( model );
+
+        double seconds = timer.nsecsElapsed() / 1e9;
+
+        // the cards in the audience area
+        QStringList colors = SyntheticAudience::colorNames();
+        QMap< QString, int > expected;
+        QPolygonF pixels;
+        foreach(QPointF p, area)
+            pixels << QPointF( p.x() * audience.image().cols, p.y() * audience.image().rows );
+        foreach(const SyntheticAudience::Card& card, audience.cards()) {
+            cv::Rect r = card.rect;
+            if (area.isEmpty() || (pixels.containsPoint( QPointF(r.x, r.y), Qt::OddEvenFill )
+                                   && pixels.containsPoint( QPointF(r.br().x, r.br().y), Qt::OddEvenFill )))
+                expected[ colors[card.color] ]++;
+        }
+
+        foreach(QString color, colors)
+            TSM_ASSERT_EQUALS( qPrintable(name + " " + color), model.cardCount(color), expected[color] );
+
+        QByteArray budgetOverride = qgetenv("VOTECOUNTER_TIME_BUDGET");
+        if (!budgetOverride.isEmpty())
+            budget = budgetOverride.toDouble();
+        TSM_ASSERT_LESS_THAN( qPrintable(name + " time budget"), seconds, budget );
+    }
+};
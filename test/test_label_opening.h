@@ -0,0 +1,37 @@
+#include <cxxtest/TestSuite.h>
+
+#include "LabelOpening.hpp"
+
+// The opening of the label image has to be the opening of every label's
+// mask on its own, the way it used to be done
+class LabelOpeningTest : public CxxTest::TestSuite {
+public:
+    void testSameAsOpeningEveryMask()
+    {
+        // blobs of three labels on nothing, with noise, over several bands
+        cv::Mat labels( 300, 211, CV_8UC1, cv::Scalar(QArtm::LabelOpening::NONE) );
+        cv::RNG rng( 5 );
+        for(int i = 0; i < 60; ++i) {
+            cv::Point corner( rng.uniform(-10, labels.cols), rng.uniform(-10, labels.rows) );
+            cv::Rect blob( corner, cv::Size( rng.uniform(1, 25), rng.uniform(1, 25) ) );
+            labels( blob & cv::Rect( cv::Point(), labels.size() ) ) = cv::Scalar( rng.uniform(0, 3) );
+        }
+        for(int i = 0; i < 2000; ++i)
+            labels.at<uchar>( rng.uniform(0, labels.rows), rng.uniform(0, labels.cols) ) =
+                    rng.uniform(0, 4) == 3 ? QArtm::LabelOpening::NONE : rng.uniform(0, 3);
+
+        for(int size = 1; size <= 5; size += 2) {
+            cv::Mat opened;
+            QArtm::LabelOpening::open( labels, opened, size );
+
+            cv::Mat kernel = cv::getStructuringElement( cv::MORPH_RECT, cv::Size(size, size) );
+            for(int label = 0; label < 3; ++label) {
+                cv::Mat mask, expected, actual;
+                cv::compare( labels, label, mask, cv::CMP_EQ );
+                cv::morphologyEx( mask, expected, cv::MORPH_OPEN, kernel );
+                cv::compare( opened, label, actual, cv::CMP_EQ );
+                TSM_ASSERT_EQUALS( size, cv::countNonZero( actual != expected ), 0 );
+            }
+        }
+    }
+};
@@ -0,0 +1,60 @@
+#include <cxxtest/TestSuite.h>
+
+#include "ApplicationFixture.hpp"
+
+#include "MetricsServer.hpp"
+#include "Profiler.hpp"
+
+// Sockets need an application to run their events, and a scrape reads the
+// image writer queue
+static ApplicationFixture applicationFixture( "test_metrics_server", ApplicationFixture::CORE, true );
+
+// What curl would see on the loopback interface
+class MetricsServerTest : public CxxTest::TestSuite {
+public:
+    void testServesProfilerNumbers()
+    {
+        QArtm::Profiler * profiler = QArtm::Profiler::instance();
+        profiler->record( "test.stage", 3000000 );   // 3 ms
+        profiler->record( "test.stage", 300000000 ); // 300 ms
+        profiler->count( "test.events", 2 );
+        profiler->setGauge( "test.level", 7 );
+
+        QArtm::MetricsServer server( "test" );
+        TS_ASSERT( server.listen(0) );
+
+        QByteArray response = get( server.port(), "/metrics" );
+        TS_ASSERT( response.startsWith("HTTP/1.0 200 OK") );
+        TS_ASSERT( response.contains("# TYPE test_stage_seconds histogram") );
+        TS_ASSERT( response.contains("test_stage_seconds_bucket{stage=\"test.stage\",le=\"0.005\"} 1\n") );
+        TS_ASSERT( response.contains("test_stage_seconds_bucket{stage=\"test.stage\",le=\"0.25\"} 1\n") );
+        TS_ASSERT( response.contains("test_stage_seconds_bucket{stage=\"test.stage\",le=\"0.5\"} 2\n") );
+        TS_ASSERT( response.contains("test_stage_seconds_bucket{stage=\"test.stage\",le=\"+Inf\"} 2\n") );
+        TS_ASSERT( response.contains("test_stage_seconds_count{stage=\"test.stage\"} 2\n") );
+        TS_ASSERT( response.contains("test_test_events_total 2\n") );
+        TS_ASSERT( response.contains("test_test_level 7\n") );
+        TS_ASSERT( response.contains("test_writes_queued 0\n") );
+    }
+
+    void testUnknownPath()
+    {
+        QArtm::MetricsServer server( "test" );
+        TS_ASSERT( server.listen(0) );
+        TS_ASSERT( get( server.port(), "/" ).startsWith("HTTP/1.0 404") );
+    }
+
+protected:
+    // the whole response, the server closes the connection when done
+    QByteArray get( quint16 port, const QByteArray& path )
+    {
+        QTcpSocket socket;
+        QEventLoop loop;
+        QObject::connect( &socket, SIGNAL(disconnected()), &loop, SLOT(quit()) );
+        QTimer::singleShot( 5000, &loop, SLOT(quit()) );
+
+        socket.connectToHost( QHostAddress::LocalHost, port );
+        socket.write( "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n" );
+        loop.exec();
+        return socket.readAll();
+    }
+};
@@ -0,0 +1,171 @@
+#include <cxxtest/TestSuite.h>
+
+#include "ApplicationFixture.hpp"
+
+#include "SubmissionQueue.hpp"
+
+// Sockets need an application to run their events
+static ApplicationFixture applicationFixture( "test_submission_queue", ApplicationFixture::CORE );
+
+// Stands in for the heckle server on the loopback interface. Requests are
+// answered in order with the statuses given, 200 once they run out, and
+// can be held back to keep one in flight.
+class StandInServer {
+public:
+    StandInServer() : m_holding(false) {
+        m_server.listen( QHostAddress::LocalHost );
+    }
+    ~StandInServer() { qDeleteAll(m_sockets); }
+
+    QUrl url() const { return QUrl( QString("http://127.0.0.1:%1/tvt.php").arg( m_server.serverPort() ) ); }
+
+    QList< int > m_statuses;
+    QStringList m_requests; // the queries received
+    bool m_holding;
+
+    // answer whatever has come in
+    void serve()
+    {
+        while (QTcpSocket * socket = m_server.nextPendingConnection())
+            m_sockets << socket;
+        foreach(QTcpSocket * socket, m_sockets) {
+            if (m_waiting.contains(socket)) {
+                if (!m_holding)
+                    respond( socket );
+                continue;
+            }
+            QByteArray request = socket->peek( 8192 );
+            if (!request.contains("\r\n\r\n"))
+                continue;
+            socket->readAll();
+            QByteArray target = request.split(' ').value(1);
+            m_requests << QString::fromLatin1( target.mid( target.indexOf('?') + 1 ) );
+            m_waiting << socket;
+            if (!m_holding)
+                respond( socket );
+        }
+    }
+
+protected:
+    QTcpServer m_server;
+    QList< QTcpSocket * > m_sockets;
+    QSet< QTcpSocket * > m_waiting;
+
+    void respond( QTcpSocket * socket )
+    {
+        m_waiting.remove( socket );
+        int status = m_statuses.isEmpty() ? 200 : m_statuses.takeFirst();
+        QByteArray body = "ok\n";
+        socket->write( "HTTP/1.1 " + QByteArray::number(status) + " Whatever\r\n"
+                       + "Content-Length: " + QByteArray::number( body.size() ) + "\r\n"
+                       + "Connection: close\r\n\r\n" + body );
+        socket->disconnectFromHost();
+    }
+};
+
+class SubmissionQueueTest : public CxxTest::TestSuite {
+public:
+    void testCoalescesToTheLatest()
+    {
+        StandInServer server;
+        QArtm::SubmissionQueue queue;
+        queue.setDebounce( 50 );
+
+        for(int i = 0; i < 20; ++i)
+            queue.submit( counts( server, i ) );
+        TS_ASSERT( runUntilIdle( server, queue ) );
+
+        TS_ASSERT_EQUALS( server.m_requests, QStringList() << "u=19" );
+        TS_ASSERT_EQUALS( queue.lastDelivered(), counts( server, 19 ) );
+    }
+
+    void testOneInFlight()
+    {
+        StandInServer server;
+        QArtm::SubmissionQueue queue;
+        queue.setDebounce( 10 );
+
+        server.m_holding = true;
+        queue.submit( counts( server, 1 ) );
+        run( server, 200 );
+        TS_ASSERT_EQUALS( server.m_requests.size(), 1 );
+
+        // newer counts wait for the first request and only the last goes
+        queue.submit( counts( server, 2 ) );
+        queue.submit( counts( server, 3 ) );
+        run( server, 200 );
+        TS_ASSERT_EQUALS( server.m_requests.size(), 1 );
+
+        server.m_holding = false;
+        TS_ASSERT( runUntilIdle( server, queue ) );
+        TS_ASSERT_EQUALS( server.m_requests, QStringList() << "u=1" << "u=3" );
+    }
+
+    void testRetriesWithBackoff()
+    {
+        StandInServer server;
+        server.m_statuses << 500 << 503;
+        QArtm::SubmissionQueue queue;
+        queue.setDebounce( 10 );
+        queue.setBackoff( 20, 100 );
+
+        queue.submit( counts( server, 7 ) );
+        TS_ASSERT( runUntilIdle( server, queue ) );
+
+        TS_ASSERT_EQUALS( server.m_requests, QStringList() << "u=7" << "u=7" << "u=7" );
+        TS_ASSERT_EQUALS( queue.lastDelivered(), counts( server, 7 ) );
+    }
+
+    void testNewerCountsReplaceAFailedOne()
+    {
+        StandInServer server;
+        server.m_statuses << 500;
+        server.m_holding = true;
+        QArtm::SubmissionQueue queue;
+        queue.setDebounce( 10 );
+        queue.setBackoff( 5000, 5000 );
+
+        queue.submit( counts( server, 1 ) );
+        run( server, 200 );
+        queue.submit( counts( server, 2 ) );
+        server.m_holding = false;
+        // no waiting out the backoff for the new counts
+        TS_ASSERT( runUntilIdle( server, queue, 2000 ) );
+
+        TS_ASSERT_EQUALS( server.m_requests, QStringList() << "u=1" << "u=2" );
+    }
+
+protected:
+    static QUrl counts( const StandInServer& server, int green )
+    {
+        QUrl url = server.url();
+        url.setEncodedQuery( "u=" + QByteArray::number(green) );
+        return url;
+    }
+
+    // process events for a while, serving the requests
+    void run( StandInServer& server, int ms )
+    {
+        QTimer tick; // wakes the event loop up
+        tick.start( 5 );
+        QElapsedTimer elapsed;
+        elapsed.start();
+        while (elapsed.elapsed() < ms) {
+            QCoreApplication::processEvents( QEventLoop::WaitForMoreEvents );
+            server.serve();
+        }
+    }
+
+    bool runUntilIdle( StandInServer& server, QArtm::SubmissionQueue& queue, int timeout = 5000 )
+    {
+        QTimer tick;
+        tick.start( 5 );
+        QElapsedTimer elapsed;
+        elapsed.start();
+        while (!queue.isIdle() && elapsed.elapsed() < timeout) {
+            QCoreApplication::processEvents( QEventLoop::WaitForMoreEvents );
+            server.serve();
+        }
+        return queue.isIdle();
+    }
+};